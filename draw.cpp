@@ -11,6 +11,13 @@
 #include "shader.h"
 #include "fbo.h"
 #include "model.h"
+#include "tilemap.h"
+#include "particle.h"
+#include "effects.h"
+#include "light.h"
+#include "programcache.h"
+#include "timer.h"
+#include "trace.h"
 
 namespace internal {
     static GLFWwindow* window = nullptr;
@@ -51,9 +58,15 @@ namespace internal {
         gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
         init_input(window);
         init_images(width, height);
+        init_program_cache();
         init_shaders();
+        init_tilemaps();
+        init_particles();
+        init_effects();
+        init_lights();
         init_default_fbo(width, height);
         init_queue();
+        wait_shaders();
         // initshaders();
         // initdefaultfbo();
         glUseProgram(find_shader(LIBDRAW_CONST(DEFAULT_SHADER)));
@@ -96,6 +109,7 @@ extern "C" void LIBDRAW_SYMBOL(window)(int width, int height, const char* title)
 static void prelude() {
     identity(transform);
     nofog();
+    noshadows();
     glUniformMatrix4fv(find_uniform("model"), 1, GL_FALSE, (const GLfloat*)transform);
     ortho(internal::width, internal::height);
     look(0, 0, 0, 0, 0);
@@ -106,10 +120,13 @@ static void prelude() {
 
 extern "C" bool LIBDRAW_SYMBOL(running)() {
     // ending frame
+    trace_begin("running");
     bindfbo(LIBDRAW_CONST(SCREEN));
     if (GLenum err = glGetError()) println("Failed to clear window: ", (int)err), exit(1);  
 
+    begin_timer("flush");
     flush(getrendermodel());
+    end_timer();
     color(WHITE);
     opacity(LIBDRAW_CONST(NORMAL_OPACITY));
 
@@ -128,14 +145,25 @@ extern "C" bool LIBDRAW_SYMBOL(running)() {
     stretched_sprite(internal::screenwidth / 2, internal::screenheight / 2, w, h, LIBDRAW_CONST(SCREEN));
     invert = true;
     prelude();
+    begin_timer("present");
     flush(getrendermodel());
+    end_timer();
     invert = false;
+    finish_frame();
+    trace_begin("swap");
     glfwSwapBuffers(internal::window);
+    trace_end();
 
     // done ending frame
+    trace_begin("input");
     update_input(internal::window, internal::screenwidth / 2 - w / 2, internal::screenheight / 2 - h / 2, w / internal::width);
+    trace_end();
     bool closed = glfwWindowShouldClose(internal::window);
-    if (closed) return false;
+    if (closed) {
+        trace_end();
+        LIBDRAW_SYMBOL(tracefile)(nullptr);
+        return false;
+    }
 
     double frame_time = glfwGetTime();
     double diff = frame_time - internal::prev_frame_time;
@@ -150,6 +178,8 @@ extern "C" bool LIBDRAW_SYMBOL(running)() {
     bindfbo(LIBDRAW_CONST(SCREEN));
     bind(LIBDRAW_CONST(DEFAULT_SHADER));
     prelude();
+    trace_end();
+    finish_trace();
     return true;
 }
 
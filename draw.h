@@ -43,6 +43,47 @@ CLINKAGE bool LIBDRAW_SYMBOL(running)();
 CLINKAGE int LIBDRAW_SYMBOL(frames)();
 CLINKAGE double LIBDRAW_SYMBOL(seconds)();
 
+enum StepKind {
+    LIBDRAW_CONST(DRAWING_STEPS),
+    LIBDRAW_CONST(SHAPE_STEPS),
+    LIBDRAW_CONST(MODEL_STEPS),
+    LIBDRAW_CONST(CAMERA_STEPS),
+    LIBDRAW_CONST(TRANSFORM_STEPS),
+    LIBDRAW_CONST(STATE_STEPS),
+    LIBDRAW_CONST(STEP_KINDS)
+};
+
+enum BreakReason {
+    LIBDRAW_CONST(TEXTURE_BREAK),
+    LIBDRAW_CONST(MODE_BREAK),
+    LIBDRAW_CONST(CAMERA_BREAK),
+    LIBDRAW_CONST(TRANSFORM_BREAK),
+    LIBDRAW_CONST(DRAW_BREAK),
+    LIBDRAW_CONST(STATE_BREAK),
+    LIBDRAW_CONST(BREAK_REASONS)
+};
+
+struct FrameStats {
+    int steps[LIBDRAW_CONST(STEP_KINDS)];
+    int breaks[LIBDRAW_CONST(BREAK_REASONS)];
+    int drawcalls, texturebinds, shaderbinds, targetswitches;
+    long long vertices, bytes;
+    double enqueuems, tessellatems, submitms;
+};
+
+CLINKAGE FrameStats LIBDRAW_SYMBOL(framestats)();
+
+struct PassTime {
+    const char* name;
+    double ms;
+};
+
+CLINKAGE void LIBDRAW_SYMBOL(gputimers)(bool enabled);
+CLINKAGE int LIBDRAW_SYMBOL(passtimes)(PassTime* times, int max);
+CLINKAGE void LIBDRAW_SYMBOL(tracefile)(const char* path);
+CLINKAGE void LIBDRAW_SYMBOL(tracebegin)(const char* name);
+CLINKAGE void LIBDRAW_SYMBOL(traceend)();
+
 // Images
 
 using Image = int;
@@ -55,6 +96,21 @@ CLINKAGE int LIBDRAW_SYMBOL(height)(Image i);
 CLINKAGE Image LIBDRAW_CONST(SCREEN);
 CLINKAGE Image LIBDRAW_CONST(BLANK);
 
+enum ImageFormat {
+    LIBDRAW_CONST(RGBA8_FORMAT) = 0,
+    LIBDRAW_CONST(R8_FORMAT) = 1,
+    LIBDRAW_CONST(RG8_FORMAT) = 2,
+    LIBDRAW_CONST(RGBA16F_FORMAT) = 3,
+    LIBDRAW_CONST(R11G11B10F_FORMAT) = 4,
+    LIBDRAW_CONST(DEPTH_FORMAT) = 5
+};
+
+CLINKAGE Image LIBDRAW_SYMBOL(formatimage)(int width, int height, ImageFormat format);
+CLINKAGE Image LIBDRAW_SYMBOL(depthimage)(Image i);
+
+CLINKAGE Image LIBDRAW_SYMBOL(target)(int width, int height, ImageFormat format, bool depth);
+CLINKAGE void LIBDRAW_SYMBOL(release)(Image i);
+
 enum TextureType {
     LIBDRAW_CONST(AUTO_CUBE), LIBDRAW_CONST(STRETCH_CUBE),
     LIBDRAW_CONST(AUTO_PILLAR), LIBDRAW_CONST(STRETCH_PILLAR),
@@ -102,6 +158,22 @@ CLINKAGE void LIBDRAW_SYMBOL(sprite)(float x, float y, Image i);
 CLINKAGE void LIBDRAW_SYMBOL(font)(Image i);
 CLINKAGE void LIBDRAW_SYMBOL(text)(float x, float y, const char* str);
 CLINKAGE void LIBDRAW_SYMBOL(wraptext)(float x, float y, const char* str, int width);
+CLINKAGE int LIBDRAW_SYMBOL(culled)();
+
+// Tilemaps
+
+using Tilemap = int;
+CLINKAGE Tilemap LIBDRAW_SYMBOL(tilemap)(Image sheet, const int* tiles, int cols, int rows, int tilew, int tileh);
+CLINKAGE void LIBDRAW_SYMBOL(settiles)(Tilemap map, int x, int y, int cols, int rows, const int* tiles);
+CLINKAGE void LIBDRAW_SYMBOL(drawtiles)(Tilemap map, float x, float y);
+
+// Particles
+
+using Emitter = int;
+CLINKAGE Emitter LIBDRAW_SYMBOL(emitter)(int capacity, Image img);
+CLINKAGE void LIBDRAW_SYMBOL(emit)(Emitter e, int count, float x, float y, float z, float vx, float vy, float vz, float spread, float life);
+CLINKAGE void LIBDRAW_SYMBOL(gravity)(Emitter e, float x, float y, float z);
+CLINKAGE void LIBDRAW_SYMBOL(particles)(Emitter e);
 
 // Transformation
 
@@ -189,6 +261,17 @@ CLINKAGE float LIBDRAW_SYMBOL(lightdirx)();
 CLINKAGE float LIBDRAW_SYMBOL(lightdiry)();
 CLINKAGE float LIBDRAW_SYMBOL(lightdirz)();
 CLINKAGE void LIBDRAW_SYMBOL(setlightdir)(float x, float y, float z);
+CLINKAGE void LIBDRAW_SYMBOL(shadowmap)(Image map, float x, float y, float z, float radius);
+CLINKAGE void LIBDRAW_SYMBOL(noshadows)();
+CLINKAGE void LIBDRAW_SYMBOL(pointlight)(float x, float y, float z, float radius, Color color);
+CLINKAGE void LIBDRAW_SYMBOL(instancing)(bool enabled);
+CLINKAGE void LIBDRAW_SYMBOL(autolod)(bool enabled);
+CLINKAGE void LIBDRAW_SYMBOL(depthsort)(bool enabled, bool prepass);
+CLINKAGE void LIBDRAW_SYMBOL(translucent)(bool enabled);
+CLINKAGE void LIBDRAW_SYMBOL(occlusion)(bool enabled);
+CLINKAGE int LIBDRAW_SYMBOL(occluded)();
+CLINKAGE void LIBDRAW_SYMBOL(measureoverdraw)(bool enabled);
+CLINKAGE float LIBDRAW_SYMBOL(overdraw)();
 
 // Camera
 
@@ -210,6 +293,17 @@ CLINKAGE void LIBDRAW_SYMBOL(sketchto)(Model model);
 CLINKAGE void LIBDRAW_SYMBOL(flush)();
 // TODO : CLINKAGE Model LIBDRAW_SYMBOL(loadobj)(const char* path);
 CLINKAGE void LIBDRAW_SYMBOL(render)(Model model, Image img);
+CLINKAGE void LIBDRAW_SYMBOL(occluder)(Model model, bool enabled);
+CLINKAGE Model LIBDRAW_SYMBOL(simplifymodel)(Model model, float ratio);
+CLINKAGE void LIBDRAW_SYMBOL(lodmodel)(Model model, int levels);
+CLINKAGE void LIBDRAW_SYMBOL(impostor)(Model model, Image img, int views, float distance);
+
+using Instance = int;
+
+CLINKAGE Instance LIBDRAW_SYMBOL(placeinstance)(Model model, Image img, const float* matrix);
+CLINKAGE void LIBDRAW_SYMBOL(moveinstance)(Instance instance, const float* matrix);
+CLINKAGE void LIBDRAW_SYMBOL(removeinstance)(Instance instance);
+CLINKAGE void LIBDRAW_SYMBOL(renderinstances)();
 
 // Effects
 
@@ -220,8 +314,31 @@ CLINKAGE const char* LIBDRAW_CONST(DEFAULT_FSH);
 CLINKAGE Shader LIBDRAW_CONST(DEFAULT_SHADER);
 
 CLINKAGE Shader LIBDRAW_SYMBOL(shader)(const char* vsh, const char* fsh);
+CLINKAGE bool LIBDRAW_SYMBOL(shaderready)(Shader shader);
+CLINKAGE void LIBDRAW_SYMBOL(shadercache)(const char* dir);
 CLINKAGE void LIBDRAW_SYMBOL(paint)(Image img);
 CLINKAGE void LIBDRAW_SYMBOL(shade)(Image img, Shader shader);
+
+enum LoadAction {
+    LIBDRAW_CONST(CLEAR_LOAD) = 0,
+    LIBDRAW_CONST(KEEP_LOAD) = 1,
+    LIBDRAW_CONST(DISCARD_LOAD) = 2
+};
+
+CLINKAGE void LIBDRAW_SYMBOL(loadaction)(Image img, LoadAction color, LoadAction depth);
+
+using PostGraph = int;
+enum { LIBDRAW_CONST(POST_SOURCE) = -1 };
+CLINKAGE PostGraph LIBDRAW_SYMBOL(postgraph)();
+CLINKAGE int LIBDRAW_SYMBOL(postpass)(PostGraph graph, Shader shader, int input, ImageFormat format, float scale);
+CLINKAGE int LIBDRAW_SYMBOL(postpixel)(PostGraph graph, const char* body, int input, ImageFormat format);
+CLINKAGE void LIBDRAW_SYMBOL(postinput)(PostGraph graph, int pass, int input);
+CLINKAGE void LIBDRAW_SYMBOL(compilepost)(PostGraph graph);
+CLINKAGE Image LIBDRAW_SYMBOL(runpost)(PostGraph graph, Image source);
+CLINKAGE Image LIBDRAW_SYMBOL(gaussblur)(Image img, float radius, float scale);
+CLINKAGE Image LIBDRAW_SYMBOL(boxblur)(Image img, float radius, float scale);
+CLINKAGE Image LIBDRAW_SYMBOL(dualblur)(Image img, int levels);
+CLINKAGE Image LIBDRAW_SYMBOL(bloom)(Image img, float threshold, float intensity, int levels);
 CLINKAGE void LIBDRAW_SYMBOL(fog)(Color color, float range);
 CLINKAGE void LIBDRAW_SYMBOL(nofog)();
 
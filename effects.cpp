@@ -0,0 +1,293 @@
+#include "effects.h"
+#include "post.h"
+#include "image.h"
+#include "shader.h"
+#include "math.h"
+#include "lib/GLAD/glad.h"
+
+// Separable kernels are applied with bilinear taps placed between pairs of
+// texels, so each tap reads two weighted texels at once.
+static const int MAX_TAPS = 32;
+static const float MAX_KERNEL_RADIUS = 2 * (MAX_TAPS - 1);
+static const float MIN_FILTER_SCALE = 1.0f / 64;
+
+static Shader copyshader, kernelshader, downshader, upshader, brightshader, combineshader;
+static GLuint linear;
+
+static const char* COPY_FSH = R"(
+    #version 330
+    in vec2 v_uv;
+    uniform sampler2D tex;
+    out vec4 color;
+
+    void main() {
+        color = texture(tex, v_uv);
+    }
+)";
+
+static const char* KERNEL_FSH = R"(
+    #version 330
+    in vec2 v_uv;
+    uniform sampler2D tex;
+    uniform vec2 texel;
+    uniform int taps;
+    uniform float offsets[32];
+    uniform float weights[32];
+    out vec4 color;
+
+    void main() {
+        color = texture(tex, v_uv) * weights[0];
+        for (int i = 1; i < taps; i ++) {
+            vec2 offset = texel * offsets[i];
+            color += (texture(tex, v_uv + offset) + texture(tex, v_uv - offset)) * weights[i];
+        }
+    }
+)";
+
+// Dual filtering: halving the resolution at each step, then doubling it back,
+// with a small fixed footprint of bilinear taps at each level.
+static const char* DOWN_FSH = R"(
+    #version 330
+    in vec2 v_uv;
+    uniform sampler2D tex;
+    uniform vec2 texel;
+    out vec4 color;
+
+    void main() {
+        color = texture(tex, v_uv) * 4.0;
+        color += texture(tex, v_uv - texel);
+        color += texture(tex, v_uv + texel);
+        color += texture(tex, v_uv + vec2(texel.x, -texel.y));
+        color += texture(tex, v_uv - vec2(texel.x, -texel.y));
+        color /= 8.0;
+    }
+)";
+
+static const char* UP_FSH = R"(
+    #version 330
+    in vec2 v_uv;
+    uniform sampler2D tex;
+    uniform vec2 texel;
+    out vec4 color;
+
+    void main() {
+        vec2 h = texel * 0.5;
+        color = texture(tex, v_uv + vec2(-h.x * 2.0, 0.0));
+        color += texture(tex, v_uv + vec2(-h.x, h.y)) * 2.0;
+        color += texture(tex, v_uv + vec2(0.0, h.y * 2.0));
+        color += texture(tex, v_uv + vec2(h.x, h.y)) * 2.0;
+        color += texture(tex, v_uv + vec2(h.x * 2.0, 0.0));
+        color += texture(tex, v_uv + vec2(h.x, -h.y)) * 2.0;
+        color += texture(tex, v_uv + vec2(0.0, -h.y * 2.0));
+        color += texture(tex, v_uv + vec2(-h.x, -h.y)) * 2.0;
+        color /= 12.0;
+    }
+)";
+
+static const char* BRIGHT_FSH = R"(
+    #version 330
+    in vec2 v_uv;
+    uniform sampler2D tex;
+    uniform float threshold;
+    out vec4 color;
+
+    void main() {
+        vec4 c = texture(tex, v_uv);
+        float l = max(c.r, max(c.g, c.b));
+        color = vec4(c.rgb * max(l - threshold, 0.0) / max(l, 0.0001), c.a);
+    }
+)";
+
+static const char* COMBINE_FSH = R"(
+    #version 330
+    in vec2 v_uv;
+    uniform sampler2D tex, tex1;
+    uniform float intensity;
+    out vec4 color;
+
+    void main() {
+        vec4 c = texture(tex, v_uv), glow = texture(tex1, v_uv);
+        color = vec4(c.rgb + glow.rgb * intensity, max(c.a, glow.a * intensity));
+    }
+)";
+
+void init_effects() {
+    copyshader = LIBDRAW_SYMBOL(shader)(LIBDRAW_CONST(DEFAULT_VSH), COPY_FSH);
+    kernelshader = LIBDRAW_SYMBOL(shader)(LIBDRAW_CONST(DEFAULT_VSH), KERNEL_FSH);
+    downshader = LIBDRAW_SYMBOL(shader)(LIBDRAW_CONST(DEFAULT_VSH), DOWN_FSH);
+    upshader = LIBDRAW_SYMBOL(shader)(LIBDRAW_CONST(DEFAULT_VSH), UP_FSH);
+    brightshader = LIBDRAW_SYMBOL(shader)(LIBDRAW_CONST(DEFAULT_VSH), BRIGHT_FSH);
+    combineshader = LIBDRAW_SYMBOL(shader)(LIBDRAW_CONST(DEFAULT_VSH), COMBINE_FSH);
+
+    glGenSamplers(1, &linear);
+    glSamplerParameteri(linear, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(linear, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(linear, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(linear, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+// Effects sample their inputs bilinearly, whatever filtering the images have.
+static PassState begineffect() {
+    PassState state = beginpasses();
+    glBindSampler(0, linear);
+    glBindSampler(1, linear);
+    return state;
+}
+
+static void endeffect(const PassState& state) {
+    glBindSampler(0, 0);
+    glBindSampler(1, 0);
+    endpasses(state);
+}
+
+// Intermediates keep the format of the image being filtered, so HDR images
+// stay HDR and masks stay single-channel. Depth can't be drawn as color.
+static ImageFormat colorformat(Image img) {
+    ImageFormat format = imgformat(img);
+    return format == LIBDRAW_CONST(DEPTH_FORMAT) ? LIBDRAW_CONST(RGBA8_FORMAT) : format;
+}
+
+static Image scaled(Image img, int w, int h) {
+    Image out = LIBDRAW_SYMBOL(target)(w, h, colorformat(img), false);
+    beginpass(copyshader, &img, 1, out);
+    endpass();
+    return out;
+}
+
+static void texel(Image img, float scale) {
+    glUniform2f(find_uniform("texel"), scale / LIBDRAW_SYMBOL(width)(img), scale / LIBDRAW_SYMBOL(height)(img));
+}
+
+// Runs a symmetric kernel horizontally, then vertically. weights[0..radius]
+// are the weights of the center texel and each distance from it.
+static Image separable(Image img, const float* weights, int radius) {
+    float offsets[MAX_TAPS], taps[MAX_TAPS];
+    int ntaps = 1;
+    offsets[0] = 0, taps[0] = weights[0];
+    for (int i = 1; i <= radius; i += 2) {
+        float a = weights[i], b = i + 1 <= radius ? weights[i + 1] : 0;
+        taps[ntaps] = a + b;
+        offsets[ntaps] = (i * a + (i + 1) * b) / (a + b);
+        ntaps ++;
+    }
+
+    int w = LIBDRAW_SYMBOL(width)(img), h = LIBDRAW_SYMBOL(height)(img);
+    Image horizontal = LIBDRAW_SYMBOL(target)(w, h, colorformat(img), false);
+    Image vertical = LIBDRAW_SYMBOL(target)(w, h, colorformat(img), false);
+    for (int pass = 0; pass < 2; pass ++) {
+        Image in = pass ? horizontal : img, out = pass ? vertical : horizontal;
+        beginpass(kernelshader, &in, 1, out);
+        glUniform2f(find_uniform("texel"), pass ? 0 : 1.0f / w, pass ? 1.0f / h : 0);
+        glUniform1i(find_uniform("taps"), ntaps);
+        glUniform1fv(find_uniform("offsets"), ntaps, offsets);
+        glUniform1fv(find_uniform("weights"), ntaps, taps);
+        endpass();
+    }
+    LIBDRAW_SYMBOL(release)(horizontal);
+    return vertical;
+}
+
+// Shrinks the image until the kernel fits, filters at that size, and scales
+// the result back up to the size of the original.
+static Image filtered(Image img, float radius, float scale, bool box) {
+    if (scale > 1) scale = 1;
+    if (scale < MIN_FILTER_SCALE) scale = MIN_FILTER_SCALE;
+    if (radius * scale > MAX_KERNEL_RADIUS) scale = MAX_KERNEL_RADIUS / radius;
+    int w = LIBDRAW_SYMBOL(width)(img), h = LIBDRAW_SYMBOL(height)(img);
+    if (radius <= 0) {
+        // nothing to blur, but the result is still a target of its own
+        PassState state = begineffect();
+        Image copy = scaled(img, w, h);
+        endeffect(state);
+        return copy;
+    }
+    int sw = ceil(w * scale), sh = ceil(h * scale);
+    if (sw < 1) sw = 1;
+    if (sh < 1) sh = 1;
+    int r = ceil(radius * scale);
+    if (r < 1) r = 1;
+
+    float weights[(int)MAX_KERNEL_RADIUS + 1], total = 0;
+    float sigma = radius * scale / 3;
+    for (int i = 0; i <= r; i ++) {
+        weights[i] = box ? 1 : exp(-0.5f * i * i / (sigma * sigma));
+        total += i ? 2 * weights[i] : weights[i];
+    }
+    for (int i = 0; i <= r; i ++) weights[i] /= total;
+
+    PassState state = begineffect();
+    bool resized = sw != w || sh != h;
+    Image small = resized ? scaled(img, sw, sh) : img;
+    Image result = separable(small, weights, r);
+    if (resized) {
+        LIBDRAW_SYMBOL(release)(small);
+        Image full = scaled(result, w, h);
+        LIBDRAW_SYMBOL(release)(result);
+        result = full;
+    }
+    endeffect(state);
+    return result;
+}
+
+extern "C" Image LIBDRAW_SYMBOL(gaussblur)(Image img, float radius, float scale) {
+    return filtered(img, radius, scale, false);
+}
+
+extern "C" Image LIBDRAW_SYMBOL(boxblur)(Image img, float radius, float scale) {
+    return filtered(img, radius, scale, true);
+}
+
+// Each level halves the size of the image, so the blur radius doubles with
+// every level while the cost of each level shrinks by four.
+static Image dual(Image img, int levels) {
+    Image chain[16];
+    int n = levels < 1 ? 1 : levels > 15 ? 15 : levels;
+    chain[0] = img;
+    for (int i = 1; i <= n; i ++) {
+        int w = LIBDRAW_SYMBOL(width)(chain[i - 1]) / 2, h = LIBDRAW_SYMBOL(height)(chain[i - 1]) / 2;
+        chain[i] = LIBDRAW_SYMBOL(target)(w < 1 ? 1 : w, h < 1 ? 1 : h, colorformat(img), false);
+        beginpass(downshader, &chain[i - 1], 1, chain[i]);
+        texel(chain[i - 1], 1);
+        endpass();
+    }
+    for (int i = n - 1; i >= 0; i --) {
+        Image up = LIBDRAW_SYMBOL(target)(LIBDRAW_SYMBOL(width)(chain[i]), LIBDRAW_SYMBOL(height)(chain[i]), colorformat(img), false);
+        beginpass(upshader, &chain[i + 1], 1, up);
+        texel(chain[i + 1], 1);
+        endpass();
+        LIBDRAW_SYMBOL(release)(chain[i + 1]);
+        if (i > 0) LIBDRAW_SYMBOL(release)(chain[i]);
+        chain[i] = up;
+    }
+    return chain[0];
+}
+
+extern "C" Image LIBDRAW_SYMBOL(dualblur)(Image img, int levels) {
+    PassState state = begineffect();
+    Image result = dual(img, levels);
+    endeffect(state);
+    return result;
+}
+
+extern "C" Image LIBDRAW_SYMBOL(bloom)(Image img, float threshold, float intensity, int levels) {
+    PassState state = begineffect();
+    int w = LIBDRAW_SYMBOL(width)(img), h = LIBDRAW_SYMBOL(height)(img);
+
+    Image bright = LIBDRAW_SYMBOL(target)(w / 2 < 1 ? 1 : w / 2, h / 2 < 1 ? 1 : h / 2, colorformat(img), false);
+    beginpass(brightshader, &img, 1, bright);
+    glUniform1f(find_uniform("threshold"), threshold);
+    endpass();
+
+    Image glow = dual(bright, levels);
+    LIBDRAW_SYMBOL(release)(bright);
+
+    Image inputs[2] = { img, glow };
+    Image result = LIBDRAW_SYMBOL(target)(w, h, colorformat(img), false);
+    beginpass(combineshader, inputs, 2, result);
+    glUniform1f(find_uniform("intensity"), intensity);
+    endpass();
+    LIBDRAW_SYMBOL(release)(glow);
+
+    endeffect(state);
+    return result;
+}
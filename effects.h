@@ -0,0 +1,8 @@
+#ifndef _LIBDRAW_EFFECTS_H
+#define _LIBDRAW_EFFECTS_H
+
+#include "draw.h"
+
+void init_effects();
+
+#endif
\ No newline at end of file
@@ -2,62 +2,132 @@
 #include "image.h"
 #include "queue.h"
 #include "shader.h"
+#include "stats.h"
 #include "lib/GLAD/glad.h"
+#include "lib/GLFW/glfw3.h"
 #include "lib/util/vec.h"
 #include "lib/util/io.h"
 
+// Depth lives in a renderbuffer unless depthimage() asks for it as a texture.
+// Images in DEPTH_FORMAT have no color at all, and are drawn to as depth.
 struct framebuffer {
-    GLuint fbo, rbo, tex;
+    GLuint fbo, rbo, tex, depthtex;
+    bool color, depth;
+    GLenum depthattachment;
+    Image depthimg;
+    LoadAction colorload, depthload;
 };
 
-static GLuint activefbo = 0;
+// A transient render target handed out by target(). Targets go back to the
+// pool when released, and are reused by later requests of the same shape. Any
+// that sit unused for too long are freed, but keep their image and framebuffer
+// slots so later targets can take them over.
+struct PooledTarget {
+    Image img;
+    int w, h;
+    ImageFormat format;
+    bool depth, inuse, freed;
+    double released;
+};
+
+typedef void (APIENTRYP InvalidateProc)(GLenum target, GLsizei count, const GLenum* attachments);
+
+static const double MAX_IDLE_SECONDS = 2;
+
+static GLuint activefbo = 0, scratchfbo = 0;
 static Image activefboimg = LIBDRAW_CONST(SCREEN);
 static vector<framebuffer> fbos;
+static vector<PooledTarget> pool;
+static InvalidateProc invalidate = nullptr;
 
-GLuint createfbo(Image image) {
-    ImageMeta& meta = findimg(image);
+// Images that have been drawn to store -(index + 1) into fbos as their parent.
+static framebuffer& findfbo(Image image, ImageMeta** root = nullptr) {
+    ImageMeta* meta = &findimg(image);
+    Image id = image;
+    while (meta->parent > 0) id = meta->parent, meta = &findimg(meta->parent);
+    if (meta->parent == 0) meta->parent = -(createfbo(id, true) + 1);
+    if (root) *root = meta;
+    return fbos[-meta->parent - 1];
+}
 
-    GLuint fbo = 0, rbo = 0;
-    glGenFramebuffers(1, &fbo);
-    glGenRenderbuffers(1, &rbo);
+static void buildfbo(framebuffer& fb, GLuint tex, int w, int h, bool depth, ImageFormat format) {
+    fb.tex = tex, fb.rbo = 0, fb.depthtex = 0;
+    fb.color = format != LIBDRAW_CONST(DEPTH_FORMAT), fb.depth = depth || !fb.color;
+    fb.depthattachment = fb.color ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+    fb.colorload = fb.depthload = LIBDRAW_CONST(CLEAR_LOAD);
+    glGenFramebuffers(1, &fb.fbo);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, meta.id, 0);
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, meta.w, meta.h);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
-    if (GLenum err = glGetError()) println("Failed to create renderbuffer: ", (int)err);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb.fbo);
+    if (!fb.color) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, tex, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    else glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+    if (depth && fb.color) {
+        glGenRenderbuffers(1, &fb.rbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, fb.rbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, fb.rbo);
+        if (GLenum err = glGetError()) println("Failed to create renderbuffer: ", (int)err);
+    }
 
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)   
         println("Framebuffer is incomplete: ", (int)glCheckFramebufferStatus(GL_FRAMEBUFFER));
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, activefbo);
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
+
+int createfbo(Image image, bool depth) {
+    ImageMeta& meta = findimg(image);
+    fbos.push({});
+    fbos.back().depthimg = -1;
+    buildfbo(fbos.back(), meta.id, meta.w, meta.h, depth, meta.format);
+    return fbos.size() - 1;
+}
+
+// Prepares the attachments of a newly bound framebuffer according to its load
+// actions. Discarded attachments are invalidated when the driver supports it,
+// and simply left alone otherwise.
+static void load(const framebuffer& fb) {
+    GLbitfield clear = 0;
+    GLenum discard[2];
+    int ndiscard = 0;
 
-    fbos.push({ fbo, rbo, meta.id });
+    if (fb.color) {
+        if (fb.colorload == LIBDRAW_CONST(CLEAR_LOAD)) clear |= GL_COLOR_BUFFER_BIT;
+        else if (fb.colorload == LIBDRAW_CONST(DISCARD_LOAD)) discard[ndiscard ++] = GL_COLOR_ATTACHMENT0;
+    }
+    if (fb.depth) {
+        if (fb.depthload == LIBDRAW_CONST(CLEAR_LOAD)) clear |= GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+        else if (fb.depthload == LIBDRAW_CONST(DISCARD_LOAD)) discard[ndiscard ++] = fb.depthattachment;
+    }
 
-    return fbo;
+    if (ndiscard && invalidate) invalidate(GL_FRAMEBUFFER, ndiscard, discard);
+    if (clear) {
+        glClearColor(0, 0, 0, 0);
+        glClear(clear);
+    }
 }
 
-void bindfbo(Image image) {
+// Restoring a target after drawing to another one keeps whatever was already
+// drawn to it, instead of applying its load actions again.
+void bindfbo(Image image, bool restore) {
     activefboimg = image;
-    ImageMeta* meta = &findimg(image);
-    Image id = image;
-    while (meta->parent > 0) id = meta->parent, meta = &findimg(meta->parent);
-    GLuint fbo = 0;
-    if (meta->parent < 0) fbo = -meta->parent;
-    else fbo = -(meta->parent = -(int)createfbo({ id }));
+    ImageMeta* meta;
+    framebuffer& fb = findfbo(image, &meta);
 
-    if (activefbo != fbo) {
-        activefbo = fbo;
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    if (activefbo != fb.fbo) {
+        activefbo = fb.fbo;
+        glBindFramebuffer(GL_FRAMEBUFFER, fb.fbo);
+        framecounts.targetswitches ++;
         int width = meta->w, height = meta->h;
         apply_default_uniforms();
         glViewport(0, 0, width, height);
-        glClearColor(0, 0, 0, 0);
         ensure3d();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); 
+        if (!restore) load(fb);
         // bindtexture({ 0 });
     }
 }
@@ -71,6 +141,7 @@ void unbindfbo() {
         activefbo = 0;
         activefboimg = SCREEN;
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        framecounts.targetswitches ++;
         glBindRenderbuffer(GL_RENDERBUFFER, 0);
         apply_default_uniforms();
         glViewport(0, 0, findimg(1).w, findimg(1).h); // image 1 is default fbo
@@ -80,18 +151,152 @@ void unbindfbo() {
     }
 }
 
+// Fills a texture on the GPU, through a framebuffer kept around just for this.
+void cleartexture(GLuint tex, float r, float g, float b, float a) {
+    if (!scratchfbo) glGenFramebuffers(1, &scratchfbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, scratchfbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+    glClearColor(r, g, b, a);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, activefbo);
+    glClearColor(0, 0, 0, 0);
+}
+
+// Depth textures can't be the only attachment while a color buffer is being
+// drawn to, so the scratch framebuffer draws nothing while it clears them.
+void cleardepth(GLuint tex) {
+    // depth writes are off while drawing in 2D, and clearing depth obeys that
+    GLboolean mask;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &mask);
+    if (!scratchfbo) glGenFramebuffers(1, &scratchfbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, scratchfbo);
+    glDrawBuffer(GL_NONE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, tex, 0);
+    glDepthMask(GL_TRUE);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glDepthMask(mask);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_FRAMEBUFFER, activefbo);
+}
+
+static void freetarget(PooledTarget& t) {
+    framebuffer& fb = findfbo(t.img);
+    glDeleteFramebuffers(1, &fb.fbo);
+    if (fb.rbo) glDeleteRenderbuffers(1, &fb.rbo);
+    if (fb.depthtex) glDeleteTextures(1, &fb.depthtex);
+    if (fb.depthimg >= 0) findimg(fb.depthimg).id = 0;
+    glDeleteTextures(1, &fb.tex);
+    fb.fbo = fb.rbo = fb.tex = fb.depthtex = 0;
+    findimg(t.img).id = 0;
+    t.freed = true;
+}
+
+// Nothing drawn to a transient target survives its release, so its contents
+// are invalidated rather than left for the driver to preserve.
+static void releasetarget(PooledTarget& t) {
+    t.inuse = false, t.released = glfwGetTime();
+    if (!invalidate) return;
+    framebuffer& fb = findfbo(t.img);
+    GLenum attachments[2];
+    int n = 0;
+    if (fb.color) attachments[n ++] = GL_COLOR_ATTACHMENT0;
+    if (fb.depth) attachments[n ++] = fb.depthattachment;
+    glBindFramebuffer(GL_FRAMEBUFFER, fb.fbo);
+    invalidate(GL_FRAMEBUFFER, n, attachments);
+    glBindFramebuffer(GL_FRAMEBUFFER, activefbo);
+}
+
+// Idle time is measured in seconds rather than frames, so targets last as long
+// whatever the frame rate.
+void release_targets() {
+    double now = glfwGetTime();
+    for (PooledTarget& t : pool) {
+        if (t.inuse) releasetarget(t);
+        else if (!t.freed && now - t.released > MAX_IDLE_SECONDS) freetarget(t);
+    }
+}
+
+extern "C" Image LIBDRAW_SYMBOL(target)(int w, int h, ImageFormat format, bool depth) {
+    PooledTarget* found = nullptr;
+    for (PooledTarget& t : pool) {
+        if (!t.inuse && !t.freed && t.w == w && t.h == h && t.format == format && t.depth == depth) {
+            found = &t;
+            break;
+        }
+    }
+    if (!found) for (PooledTarget& t : pool) if (t.freed) {
+        found = &t;
+        break;
+    }
+
+    if (!found) {
+        Image img = createimg({ 0, 0, w, h, newtexture(w, h, format), 0, format });
+        findimg(img).parent = -(createfbo(img, depth) + 1);
+        pool.push({ img, w, h, format, depth, false, false, 0 });
+        found = &pool.back();
+    }
+    else if (found->freed) {
+        ImageMeta& meta = findimg(found->img);
+        meta.w = w, meta.h = h, meta.id = newtexture(w, h, format), meta.format = format;
+        buildfbo(findfbo(found->img), meta.id, w, h, depth, format);
+        found->w = w, found->h = h, found->format = format, found->depth = depth, found->freed = false;
+    }
+
+    framebuffer& fb = findfbo(found->img);
+    fb.colorload = fb.depthload = LIBDRAW_CONST(CLEAR_LOAD);
+    found->inuse = true;
+    return found->img;
+}
+
+extern "C" void LIBDRAW_SYMBOL(release)(Image img) {
+    for (PooledTarget& t : pool) if (t.img == img) {
+        if (t.inuse) releasetarget(t);
+        return;
+    }
+    println("Tried to release an image that isn't a render target!");
+}
+
+// Swaps the depth renderbuffer of an image for a texture the first time its
+// depth is asked for. Whatever depth was drawn before the swap is lost.
+extern "C" Image LIBDRAW_SYMBOL(depthimage)(Image img) {
+    ImageMeta* root;
+    framebuffer& fb = findfbo(img, &root);
+    if (!fb.color) return img;
+    if (!fb.depth) {
+        println("Tried to get the depth of an image drawn without depth!");
+        return LIBDRAW_CONST(BLANK);
+    }
+    if (fb.depthtex) return fb.depthimg;
+
+    fb.depthtex = newtexture(root->w, root->h, LIBDRAW_CONST(DEPTH_FORMAT));
+    if (fb.depthimg < 0) fb.depthimg = createimg({ 0, 0, root->w, root->h, fb.depthtex, 0, LIBDRAW_CONST(DEPTH_FORMAT) });
+    else {
+        ImageMeta& meta = findimg(fb.depthimg);
+        meta.w = root->w, meta.h = root->h, meta.id = fb.depthtex;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fb.fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, fb.depthtex, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, activefbo);
+    if (fb.rbo) glDeleteRenderbuffers(1, &fb.rbo);
+    fb.rbo = 0, fb.depthattachment = GL_DEPTH_ATTACHMENT;
+    return fb.depthimg;
+}
+
+extern "C" void LIBDRAW_SYMBOL(loadaction)(Image img, LoadAction color, LoadAction depth) {
+    framebuffer& fb = findfbo(img);
+    fb.colorload = color, fb.depthload = depth;
+}
+
 ImageMeta init_default_fbo(int width, int height) {
-    GLuint fbtex, fbo, rbo;
-    glGenTextures(1, &fbtex);
+    GLuint fbtex = newtexture(width, height, LIBDRAW_CONST(RGBA8_FORMAT)), fbo, rbo;
     glGenFramebuffers(1, &fbo);
     glGenRenderbuffers(1, &rbo);
 
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-
-    glBindTexture(GL_TEXTURE_2D, fbtex);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fbtex, 0);
 
     if (GLenum err = glGetError()) println("Failed to create default framebuffer texture: ", (int)err);
@@ -106,6 +311,9 @@ ImageMeta init_default_fbo(int width, int height) {
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
-    fbos.push({ fbo, rbo, fbtex });
-    return { 0, 0, width, height, fbtex, { -int(fbo) } };
+    if (glfwExtensionSupported("GL_ARB_invalidate_subdata"))
+        invalidate = (InvalidateProc)glfwGetProcAddress("glInvalidateFramebuffer");
+
+    fbos.push({ fbo, rbo, fbtex, 0, true, true, GL_DEPTH_STENCIL_ATTACHMENT, -1, LIBDRAW_CONST(CLEAR_LOAD), LIBDRAW_CONST(CLEAR_LOAD) });
+    return { 0, 0, width, height, fbtex, { -int(fbos.size()) }, LIBDRAW_CONST(RGBA8_FORMAT) };
 }
\ No newline at end of file
@@ -4,9 +4,12 @@
 #include "draw.h"
 #include "image.h"
 
-GLuint createfbo(Image img);
-void bindfbo(Image img);
+int createfbo(Image img, bool depth);
+void bindfbo(Image img, bool restore = false);
 void unbindfbo();
+void cleartexture(GLuint tex, float r, float g, float b, float a);
+void cleardepth(GLuint tex);
+void release_targets();
 ImageMeta init_default_fbo(int width, int height);
 Image currentfbo();
 
@@ -0,0 +1,245 @@
+#include "hiz.h"
+#include "math.h"
+#include "string.h"
+
+static float zbuffer[HIZ_WIDTH * HIZ_HEIGHT];
+static float levels[HIZ_LEVELS][(HIZ_WIDTH / 2) * (HIZ_HEIGHT / 2)];
+static bool empty = true, built = false;
+
+void clear_hiz() {
+    empty = true, built = false;
+}
+
+bool hiz_empty() {
+    return empty;
+}
+
+struct ClipVertex {
+    float x, y, z, w;
+};
+
+static ClipVertex toclip(float mvp[4][4], float x, float y, float z) {
+    return {
+        x * mvp[0][0] + y * mvp[1][0] + z * mvp[2][0] + mvp[3][0],
+        x * mvp[0][1] + y * mvp[1][1] + z * mvp[2][1] + mvp[3][1],
+        x * mvp[0][2] + y * mvp[1][2] + z * mvp[2][2] + mvp[3][2],
+        x * mvp[0][3] + y * mvp[1][3] + z * mvp[2][3] + mvp[3][3]
+    };
+}
+
+// Four pixels of a row are filled at once. The last group of a row can run
+// past its end, into the next row or the padding after the last one, but
+// pixels past the end are never written to.
+typedef float floatx4 __attribute__((vector_size(16)));
+typedef int intx4 __attribute__((vector_size(16)));
+
+// Each occluder is drawn into a buffer of its own first, which is far wherever
+// the occluder isn't, and only merged into the depth buffer once it's done.
+static float scratch[HIZ_WIDTH * HIZ_HEIGHT + 4], rowmax[HIZ_WIDTH * HIZ_HEIGHT];
+static int sx0, sy0, sx1, sy1;
+
+// Fills the pixels whose centers fall in the triangle, keeping the nearest
+// depth. Depth is interpolated linearly in screen space, which z / w is. The
+// barycentrics step by a constant from one pixel to the next, so each group of
+// four is the one before plus four steps.
+static void fill(const float* a, const float* b, const float* c) {
+    float area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+    if (fabs(area) < 1e-8f) return;
+    float inv = 1 / area;
+
+    int x0 = floor(fmin(a[0], fmin(b[0], c[0]))), x1 = ceil(fmax(a[0], fmax(b[0], c[0])));
+    int y0 = floor(fmin(a[1], fmin(b[1], c[1]))), y1 = ceil(fmax(a[1], fmax(b[1], c[1])));
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > HIZ_WIDTH) x1 = HIZ_WIDTH;
+    if (y1 > HIZ_HEIGHT) y1 = HIZ_HEIGHT;
+    if (x0 >= x1 || y0 >= y1) return;
+    if (x0 < sx0) sx0 = x0;
+    if (y0 < sy0) sy0 = y0;
+    if (x1 > sx1) sx1 = x1;
+    if (y1 > sy1) sy1 = y1;
+
+    // u and v as functions of the pixel center
+    float dux = -(c[1] - b[1]) * inv, duy = (c[0] - b[0]) * inv;
+    float dvx = -(a[1] - c[1]) * inv, dvy = (a[0] - c[0]) * inv;
+    float u0 = -(dux * b[0] + duy * b[1]), v0 = -(dvx * c[0] + dvy * c[1]);
+    float za = a[2] - c[2], zb = b[2] - c[2];
+    const floatx4 lanes = { 0.5f, 1.5f, 2.5f, 3.5f }, one = { 1, 1, 1, 1 }, zero = { 0, 0, 0, 0 };
+
+    for (int y = y0; y < y1; y ++) {
+        float py = y + 0.5f;
+        float* row = scratch + y * HIZ_WIDTH;
+        floatx4 px = (float)x0 + lanes;
+        floatx4 u = u0 + duy * py + dux * px, v = v0 + dvy * py + dvx * px;
+        floatx4 stepu = one * (4 * dux), stepv = one * (4 * dvx), stepx = one * 4, end = one * (float)x1;
+        for (int x = x0; x < x1; x += 4) {
+            floatx4 w = one - u - v;
+            intx4 in = (u >= zero) & (v >= zero) & (w >= zero) & (px < end);
+            floatx4 z = c[2] + u * za + v * zb;
+            floatx4 old;
+            memcpy(&old, row + x, sizeof(old));
+            floatx4 nearer = in ? (z < old ? z : old) : old;
+            memcpy(row + x, &nearer, sizeof(nearer));
+            u += stepu, v += stepv, px += stepx;
+        }
+    }
+}
+
+// Merges the occluder in, keeping only the pixels whose whole 3x3
+// neighbourhood it covered, at the farthest depth there. A pixel's center
+// being covered says nothing about its corners, but its neighbours' centers
+// surround all of it, so this never claims to cover more than the occluder
+// did. Then the scratch buffer is put back to far for the next occluder.
+static void merge() {
+    if (sx0 >= sx1) return;
+    int ry0 = sy0 > 0 ? sy0 - 1 : 0, ry1 = sy1 < HIZ_HEIGHT ? sy1 + 1 : HIZ_HEIGHT;
+    for (int y = ry0; y < ry1; y ++) {
+        const float* row = scratch + y * HIZ_WIDTH;
+        float* out = rowmax + y * HIZ_WIDTH;
+        for (int x = sx0; x < sx1; x ++) {
+            float m = row[x];
+            if (x > 0 && row[x - 1] > m) m = row[x - 1];
+            if (x + 1 < HIZ_WIDTH && row[x + 1] > m) m = row[x + 1];
+            out[x] = m;
+        }
+    }
+    for (int y = sy0; y < sy1; y ++) {
+        const float* above = rowmax + (y > 0 ? y - 1 : y) * HIZ_WIDTH;
+        const float* middle = rowmax + y * HIZ_WIDTH;
+        const float* below = rowmax + (y + 1 < HIZ_HEIGHT ? y + 1 : y) * HIZ_WIDTH;
+        float* depth = zbuffer + y * HIZ_WIDTH;
+        int x = sx0;
+        for (; x + 4 <= sx1; x += 4) {
+            floatx4 a, m, b, d;
+            memcpy(&a, above + x, sizeof(a)), memcpy(&m, middle + x, sizeof(m));
+            memcpy(&b, below + x, sizeof(b)), memcpy(&d, depth + x, sizeof(d));
+            m = a > m ? a : m;
+            m = b > m ? b : m;
+            d = m < d ? m : d;
+            memcpy(depth + x, &d, sizeof(d));
+        }
+        for (; x < sx1; x ++) {
+            float m = fmax(above[x], fmax(middle[x], below[x]));
+            if (m < depth[x]) depth[x] = m;
+        }
+    }
+    for (int y = sy0; y < sy1; y ++) for (int x = sx0; x < sx1; x ++) scratch[y * HIZ_WIDTH + x] = 1;
+    sx0 = sy0 = HIZ_WIDTH, sx1 = sy1 = 0;
+}
+
+// Clips against the near plane, where z = -w, then fans out what's left.
+static void triangle(const ClipVertex& p, const ClipVertex& q, const ClipVertex& r) {
+    ClipVertex in[3] = { p, q, r }, out[4];
+    int n = 0;
+    for (int i = 0; i < 3; i ++) {
+        const ClipVertex& s = in[i];
+        const ClipVertex& e = in[(i + 1) % 3];
+        float ds = s.z + s.w, de = e.z + e.w;
+        if (ds >= 0) out[n ++] = s;
+        if ((ds >= 0) != (de >= 0)) {
+            float t = ds / (ds - de);
+            out[n ++] = { s.x + (e.x - s.x) * t, s.y + (e.y - s.y) * t, s.z + (e.z - s.z) * t, s.w + (e.w - s.w) * t };
+        }
+    }
+    if (n < 3) return;
+
+    float screen[4][3];
+    for (int i = 0; i < n; i ++) {
+        float w = out[i].w > 1e-6f ? out[i].w : 1e-6f;
+        screen[i][0] = (out[i].x / w * 0.5f + 0.5f) * HIZ_WIDTH;
+        screen[i][1] = (out[i].y / w * 0.5f + 0.5f) * HIZ_HEIGHT;
+        screen[i][2] = out[i].z / w;
+    }
+    for (int i = 1; i + 1 < n; i ++) fill(screen[0], screen[i], screen[i + 1]);
+}
+
+static void box(float mvp[4][4], const float lo[3], const float hi[3]) {
+    static const int faces[6][4] = {
+        { 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 },
+        { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 }
+    };
+    ClipVertex corners[8];
+    for (int i = 0; i < 8; i ++)
+        corners[i] = toclip(mvp, i & 1 ? hi[0] : lo[0], i & 2 ? hi[1] : lo[1], i & 4 ? hi[2] : lo[2]);
+    for (const auto& f : faces) {
+        triangle(corners[f[0]], corners[f[1]], corners[f[2]]);
+        triangle(corners[f[0]], corners[f[2]], corners[f[3]]);
+    }
+}
+
+// Uses the same triangles the GPU draws, plus a box for each cube instance.
+// Boards are left out, since they're usually small and full of holes.
+// Depths are normalized device z, so the buffer starts out at 1, as far as
+// anything can be.
+void rasterize_occluder(const Buffer& buf, float mvp[4][4]) {
+    static bool ready = false;
+    if (!ready) {
+        for (float& d : scratch) d = 1;
+        sx0 = sy0 = HIZ_WIDTH, sx1 = sy1 = 0;
+        ready = true;
+    }
+    if (empty) for (float& d : zbuffer) d = 1;
+    empty = false, built = false;
+    const vector<float>& v = buf.verts;
+    for (u32 i = 0; i + 8 < v.size(); i += 9)
+        triangle(toclip(mvp, v[i], v[i + 1], v[i + 2]), toclip(mvp, v[i + 3], v[i + 4], v[i + 5]), toclip(mvp, v[i + 6], v[i + 7], v[i + 8]));
+    for (u32 i = 0; i + CUBE_INSTANCE <= buf.cubes.size(); i += CUBE_INSTANCE) {
+        const float* c = &buf.cubes[i];
+        float lo[3] = { c[0] - c[3] / 2, c[1] - c[4] / 2, c[2] - c[5] / 2 };
+        float hi[3] = { c[0] + c[3] / 2, c[1] + c[4] / 2, c[2] + c[5] / 2 };
+        box(mvp, lo, hi);
+    }
+    merge();
+}
+
+// Each level keeps the farthest depth of the 2x2 block below it, so a box
+// nearer than every texel it covers is visible.
+static void build() {
+    const float* below = zbuffer;
+    int w = HIZ_WIDTH, h = HIZ_HEIGHT;
+    for (int level = 0; level < HIZ_LEVELS; level ++) {
+        int lw = w / 2, lh = h / 2;
+        for (int y = 0; y < lh; y ++) for (int x = 0; x < lw; x ++) {
+            const float* s = below + 2 * y * w + 2 * x;
+            levels[level][y * lw + x] = fmax(fmax(s[0], s[1]), fmax(s[w], s[w + 1]));
+        }
+        below = levels[level], w = lw, h = lh;
+    }
+    built = true;
+}
+
+bool hiz_visible(const float lo[3], const float hi[3], float mvp[4][4]) {
+    if (empty) return true;
+    float minx = 1e30f, miny = 1e30f, maxx = -1e30f, maxy = -1e30f, minz = 1e30f;
+    for (int i = 0; i < 8; i ++) {
+        ClipVertex c = toclip(mvp, i & 1 ? hi[0] : lo[0], i & 2 ? hi[1] : lo[1], i & 4 ? hi[2] : lo[2]);
+        if (c.w <= 1e-6f || c.z < -c.w) return true;
+        float x = c.x / c.w, y = c.y / c.w, z = c.z / c.w;
+        minx = fmin(minx, x), maxx = fmax(maxx, x);
+        miny = fmin(miny, y), maxy = fmax(maxy, y);
+        minz = fmin(minz, z);
+    }
+    int x0 = floor((minx * 0.5f + 0.5f) * HIZ_WIDTH), x1 = ceil((maxx * 0.5f + 0.5f) * HIZ_WIDTH);
+    int y0 = floor((miny * 0.5f + 0.5f) * HIZ_HEIGHT), y1 = ceil((maxy * 0.5f + 0.5f) * HIZ_HEIGHT);
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > HIZ_WIDTH) x1 = HIZ_WIDTH;
+    if (y1 > HIZ_HEIGHT) y1 = HIZ_HEIGHT;
+    if (x0 >= x1 || y0 >= y1) return true;
+
+    // small boxes are tested against the full depth buffer, larger ones at
+    // the level where they cover a handful of texels
+    const float* texels = zbuffer;
+    int level = -1, w = HIZ_WIDTH;
+    while ((x1 - x0 > 4 || y1 - y0 > 4) && level + 1 < HIZ_LEVELS) {
+        level ++, w /= 2;
+        x0 /= 2, y0 /= 2, x1 = (x1 + 1) / 2, y1 = (y1 + 1) / 2;
+    }
+    if (level >= 0) {
+        if (!built) build();
+        texels = levels[level];
+    }
+    for (int y = y0; y < y1; y ++) for (int x = x0; x < x1; x ++)
+        if (texels[y * w + x] >= minz) return true;
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef _LIBDRAW_HIZ_H
+#define _LIBDRAW_HIZ_H
+
+#include "model.h"
+
+// A small depth buffer on the CPU, with a pyramid of the farthest depth in
+// each block above it. Occluders are drawn into it, and bounding boxes tested
+// against it, all in clip space for a given model-view-projection matrix.
+enum HizSize {
+    HIZ_WIDTH = 256,
+    HIZ_HEIGHT = 128,
+    HIZ_LEVELS = 7
+};
+
+void clear_hiz();
+bool hiz_empty();
+void rasterize_occluder(const Buffer& buf, float mvp[4][4]);
+bool hiz_visible(const float lo[3], const float hi[3], float mvp[4][4]);
+
+#endif
\ No newline at end of file
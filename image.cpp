@@ -3,6 +3,7 @@
 #include "lib/util/vec.h"
 #include "string.h"
 #include "fbo.h"
+#include "trace.h"
 
 static vector<ImageMeta> images;
 
@@ -10,12 +11,50 @@ ImageMeta& findimg(Image img) {
     return images[img];
 }
 
-static Image createimg(ImageMeta meta) {
+Image createimg(ImageMeta meta) {
     images.push(meta);
     return images.size() - 1;
 }
 
+// Allocates storage for a texture without uploading anything to it.
+GLuint newtexture(int w, int h, ImageFormat format) {
+    GLuint id;
+    glGenTextures(1, &id);
+
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    switch (format) {
+        default:
+        case LIBDRAW_CONST(RGBA8_FORMAT):
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            break;
+        case LIBDRAW_CONST(R8_FORMAT):
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+            break;
+        case LIBDRAW_CONST(RG8_FORMAT):
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, w, h, 0, GL_RG, GL_UNSIGNED_BYTE, nullptr);
+            break;
+        case LIBDRAW_CONST(RGBA16F_FORMAT):
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+            break;
+        case LIBDRAW_CONST(R11G11B10F_FORMAT):
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, w, h, 0, GL_RGB, GL_HALF_FLOAT, nullptr);
+            break;
+        case LIBDRAW_CONST(DEPTH_FORMAT): {
+            // sampled depth reads as gray, instead of only filling the red channel
+            static const GLint swizzle[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+            break;
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return id;
+}
+
 extern "C" Image LIBDRAW_SYMBOL(image)(const char* path) {
+    trace_begin("image");
     int width, height, channels;
     unsigned char* img = SOIL_load_image(path, &width, &height, &channels, SOIL_LOAD_RGBA);
     unsigned char* inverted = new unsigned char[width * height * 4];
@@ -37,8 +76,9 @@ extern "C" Image LIBDRAW_SYMBOL(image)(const char* path) {
     SOIL_free_image_data(img);
     delete[] inverted;
 
-    Image result = createimg({ 0, 0, width, height, id });
+    Image result = createimg({ 0, 0, width, height, id, 0, LIBDRAW_CONST(RGBA8_FORMAT) });
     // printf("loaded image %s into id %d\n", path, result.id);
+    trace_end();
     return result;
 }
 
@@ -57,7 +97,7 @@ void init_images(int width, int height) {
     glBindTexture(GL_TEXTURE_2D, 0);
 
     delete[] data;
-    images.push({ 0, 0, 8, 8, id, { 0 }});
+    images.push({ 0, 0, 8, 8, id, { 0 }, LIBDRAW_CONST(RGBA8_FORMAT) });
     images.push(init_default_fbo(width, height));
     LIBDRAW_CONST(BLANK) = 0;
     LIBDRAW_CONST(SCREEN) = 1;
@@ -67,27 +107,27 @@ Image LIBDRAW_CONST(SCREEN);
 Image LIBDRAW_CONST(BLANK);
 
 extern "C" Image LIBDRAW_SYMBOL(newimage)(int w, int h) {
-    GLuint* data = new GLuint[w * h];
-    for (int i = 0; i < w * h; i ++) data[i] = 0xffffffff;
-
-    GLuint id;
-    glGenTextures(1, &id);
-        
-    glBindTexture(GL_TEXTURE_2D, id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, 
-                    GL_UNSIGNED_BYTE, data);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    return LIBDRAW_SYMBOL(formatimage)(w, h, LIBDRAW_CONST(RGBA8_FORMAT));
+}
 
-    delete[] data;
-    images.push({ 0, 0, w, h, id, { 0 }});
+extern "C" Image LIBDRAW_SYMBOL(formatimage)(int w, int h, ImageFormat format) {
+    GLuint id = newtexture(w, h, format);
+    if (format == LIBDRAW_CONST(DEPTH_FORMAT)) cleardepth(id);
+    else cleartexture(id, 1, 1, 1, 1);
+    images.push({ 0, 0, w, h, id, { 0 }, format });
     return images.size() - 1;
 }
 
+// Subimages share the format of the image they were cut from.
+ImageFormat imgformat(Image i) {
+    ImageMeta* meta = &findimg(i);
+    while (meta->parent > 0) meta = &findimg(meta->parent);
+    return meta->format;
+}
+
 extern "C" Image LIBDRAW_SYMBOL(subimage)(Image i, int x, int y, int w, int h) {
     ImageMeta& meta = findimg(i);
-    images.push({ x, y, w, h, meta.id, i });
+    images.push({ x, y, w, h, meta.id, i, imgformat(i) });
     return images.size() - 1;
 }
 
@@ -8,9 +8,13 @@ struct ImageMeta {
     int x, y, w, h;
     GLuint id;
     Image parent;
+    ImageFormat format;
 };
 
 ImageMeta& findimg(Image i);
+Image createimg(ImageMeta meta);
+GLuint newtexture(int width, int height, ImageFormat format);
+ImageFormat imgformat(Image i);
 void init_images(int width, int height);
 
 #endif
\ No newline at end of file
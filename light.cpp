@@ -0,0 +1,165 @@
+#include "light.h"
+#include "shader.h"
+#include "lib/GLAD/glad.h"
+#include "lib/util/vec.h"
+#include "lib/util/io.h"
+#include "string.h"
+#include "math.h"
+
+static const int MAX_LIGHTS = 1024;
+static const int MAX_LIGHT_REFS = 65536;
+
+static vector<PointLight> lights;
+static GLuint databuf, clusterbuf, datatex, clustertex;
+static int maxrefs;
+
+// Binning is redone only when the lights, the camera, or the target size have
+// changed since the last time.
+static bool dirty = true;
+static float lastview[4][4], lastprojection[4][4];
+static int lastwidth = 0, lastheight = 0, binned = 0;
+
+void init_lights() {
+    glGenBuffers(1, &databuf);
+    glGenBuffers(1, &clusterbuf);
+    glGenTextures(1, &datatex);
+    glGenTextures(1, &clustertex);
+
+    glBindBuffer(GL_TEXTURE_BUFFER, databuf);
+    glBufferData(GL_TEXTURE_BUFFER, MAX_LIGHTS * sizeof(PointLight), nullptr, GL_STREAM_DRAW);
+    // the cluster ranges and the light references share one texture buffer,
+    // which may be no larger than the driver allows - only 65536 texels for
+    // some
+    GLint limit;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &limit);
+    maxrefs = limit - NUM_CLUSTERS * 2 < MAX_LIGHT_REFS ? limit - NUM_CLUSTERS * 2 : MAX_LIGHT_REFS;
+    glBindBuffer(GL_TEXTURE_BUFFER, clusterbuf);
+    glBufferData(GL_TEXTURE_BUFFER, (NUM_CLUSTERS * 2 + maxrefs) * sizeof(GLint), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glActiveTexture(GL_TEXTURE0 + LIGHT_DATA_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, datatex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, databuf);
+    glActiveTexture(GL_TEXTURE0 + LIGHT_CLUSTER_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, clustertex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, clusterbuf);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Maps a view space depth to a slice. Perspective views slice logarithmically,
+// so that slices near the camera stay thin; orthographic ones slice evenly.
+static float slice(float depth, float near, float far) {
+    if (near > 0) return log(fmax(depth, near) / near) / log(far / near) * CLUSTER_Z;
+    return (depth - near) / (far - near) * CLUSTER_Z;
+}
+
+static int clampi(int x, int lo, int hi) {
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+// Finds the range of clusters a light's sphere can touch, from the screen
+// rectangle covered by the corners of its bounding box. If any corner is
+// behind the camera, the light is assumed to cover the whole screen.
+static bool bounds(const PointLight& l, float view[4][4], float projection[4][4], float near, float far, int lo[3], int hi[3]) {
+    float vx = l.x * view[0][0] + l.y * view[1][0] + l.z * view[2][0] + view[3][0];
+    float vy = l.x * view[0][1] + l.y * view[1][1] + l.z * view[2][1] + view[3][1];
+    float vz = l.x * view[0][2] + l.y * view[1][2] + l.z * view[2][2] + view[3][2];
+
+    float zlo = slice(-vz - l.radius, near, far), zhi = slice(-vz + l.radius, near, far);
+    if (zhi < 0 || zlo >= CLUSTER_Z) return false;
+
+    float minx = 1, miny = 1, maxx = -1, maxy = -1;
+    bool full = false;
+    for (int i = 0; i < 8 && !full; i ++) {
+        float cx = vx + (i & 1 ? l.radius : -l.radius);
+        float cy = vy + (i & 2 ? l.radius : -l.radius);
+        float cz = vz + (i & 4 ? l.radius : -l.radius);
+        float px = cx * projection[0][0] + cy * projection[1][0] + cz * projection[2][0] + projection[3][0];
+        float py = cx * projection[0][1] + cy * projection[1][1] + cz * projection[2][1] + projection[3][1];
+        float pw = cx * projection[0][3] + cy * projection[1][3] + cz * projection[2][3] + projection[3][3];
+        if (pw <= 0) full = true;
+        else {
+            minx = fmin(minx, px / pw), maxx = fmax(maxx, px / pw);
+            miny = fmin(miny, py / pw), maxy = fmax(maxy, py / pw);
+        }
+    }
+    if (full) minx = miny = -1, maxx = maxy = 1;
+    if (maxx < -1 || minx > 1 || maxy < -1 || miny > 1) return false;
+
+    lo[0] = clampi(floor((minx + 1) / 2 * CLUSTER_X), 0, CLUSTER_X - 1);
+    hi[0] = clampi(floor((maxx + 1) / 2 * CLUSTER_X), 0, CLUSTER_X - 1);
+    lo[1] = clampi(floor((miny + 1) / 2 * CLUSTER_Y), 0, CLUSTER_Y - 1);
+    hi[1] = clampi(floor((maxy + 1) / 2 * CLUSTER_Y), 0, CLUSTER_Y - 1);
+    lo[2] = clampi(floor(zlo), 0, CLUSTER_Z - 1);
+    hi[2] = clampi(floor(zhi), 0, CLUSTER_Z - 1);
+    return true;
+}
+
+// Sorts the lights into clusters, and uploads the results. The cluster buffer
+// starts with an (offset, count) pair for every cluster, followed by the light
+// indices the offsets point into.
+int bin_lights(float view[4][4], float projection[4][4], float near, float far, int width, int height) {
+    if (lights.size() == 0) return binned = 0;
+    if (!dirty && width == lastwidth && height == lastheight
+        && !memcmp(view, lastview, sizeof(lastview)) && !memcmp(projection, lastprojection, sizeof(lastprojection)))
+        return binned;
+    dirty = false, lastwidth = width, lastheight = height;
+    memcpy(lastview, view, sizeof(lastview));
+    memcpy(lastprojection, projection, sizeof(lastprojection));
+
+    static vector<int> counts, refs;
+    static vector<int> ranges;
+    counts.clear(), refs.clear(), ranges.clear();
+    for (int i = 0; i < NUM_CLUSTERS; i ++) counts.push(0);
+
+    // first count the lights in each cluster, then fill in their indices
+    for (u32 i = 0; i < lights.size(); i ++) {
+        int lo[3] = { 1, 1, 1 }, hi[3] = { 0, 0, 0 };
+        bounds(lights[i], view, projection, near, far, lo, hi);
+        for (int j = 0; j < 3; j ++) ranges.push(lo[j]), ranges.push(hi[j]);
+        for (int z = lo[2]; z <= hi[2]; z ++) for (int y = lo[1]; y <= hi[1]; y ++) for (int x = lo[0]; x <= hi[0]; x ++)
+            counts[(z * CLUSTER_Y + y) * CLUSTER_X + x] ++;
+    }
+
+    int total = NUM_CLUSTERS * 2;
+    for (int i = 0; i < NUM_CLUSTERS * 2; i ++) refs.push(0);
+    for (int i = 0; i < NUM_CLUSTERS; i ++) {
+        if (total + counts[i] > NUM_CLUSTERS * 2 + maxrefs) counts[i] = 0;
+        refs[i * 2] = total, refs[i * 2 + 1] = 0;
+        total += counts[i];
+    }
+    for (int i = NUM_CLUSTERS * 2; i < total; i ++) refs.push(0);
+    for (u32 i = 0; i < lights.size(); i ++) {
+        const int* r = &ranges[i * 6];
+        for (int z = r[4]; z <= r[5]; z ++) for (int y = r[2]; y <= r[3]; y ++) for (int x = r[0]; x <= r[1]; x ++) {
+            int c = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+            if (refs[c * 2 + 1] < counts[c]) refs[refs[c * 2] + refs[c * 2 + 1] ++] = i;
+        }
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, databuf);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, lights.size() * sizeof(PointLight), &lights[0]);
+    glBindBuffer(GL_TEXTURE_BUFFER, clusterbuf);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, total * sizeof(GLint), &refs[0]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    return binned = lights.size();
+}
+
+int binned_lights() {
+    return binned;
+}
+
+void clear_lights() {
+    if (lights.size()) dirty = true;
+    lights.clear();
+}
+
+extern "C" void LIBDRAW_SYMBOL(pointlight)(float x, float y, float z, float radius, Color color) {
+    if (lights.size() == MAX_LIGHTS) {
+        println("Too many point lights! The limit is ", MAX_LIGHTS, " per frame.");
+        return;
+    }
+    float intensity = (color & 255) / 255.0f;
+    lights.push({ x, y, z, radius, (color >> 24 & 255) / 255.0f, (color >> 16 & 255) / 255.0f, (color >> 8 & 255) / 255.0f, intensity });
+    dirty = true;
+}
@@ -0,0 +1,25 @@
+#ifndef _LIBDRAW_LIGHT_H
+#define _LIBDRAW_LIGHT_H
+
+#include "draw.h"
+
+// The view is split into CLUSTER_X by CLUSTER_Y tiles on screen, and
+// CLUSTER_Z slices in depth. These must match the constants in DEFAULT_FSH.
+enum ClusterGrid {
+    CLUSTER_X = 16,
+    CLUSTER_Y = 8,
+    CLUSTER_Z = 24,
+    NUM_CLUSTERS = CLUSTER_X * CLUSTER_Y * CLUSTER_Z
+};
+
+struct PointLight {
+    float x, y, z, radius;
+    float r, g, b, intensity;
+};
+
+int bin_lights(float view[4][4], float projection[4][4], float near, float far, int width, int height);
+int binned_lights();
+void clear_lights();
+void init_lights();
+
+#endif
\ No newline at end of file
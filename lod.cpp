@@ -0,0 +1,90 @@
+#include "lod.h"
+#include "math.h"
+#include "lib/util/hash.h"
+
+static float pi = 3.14159265358979323f;
+
+// A polygon with n sides strays r (1 - cos(pi / n)) from a circle of radius r,
+// about r pi^2 / 2n^2, which is kept under half a pixel. Shapes only drop a
+// level once a quarter more sides than needed would still fit in the lower
+// one, so one sitting at a boundary doesn't flicker between the two.
+static const int LEVELS[] = { 6, 8, 12, 16, 24, 32, 48, 64 };
+static const int NUM_LEVELS = sizeof(LEVELS) / sizeof(int);
+static const float TOLERANCE = 0.5f, HYSTERESIS = 1.25f;
+
+static map<int, vector<float>> rings;
+static map<int, UnitSphere> spheres;
+
+const float* unit_ring(int n) {
+    auto it = rings.find(n);
+    if (it != rings.end()) return it->second.begin();
+    vector<float>& ring = rings[n];
+    for (int i = 0; i <= n; i ++) {
+        float a = 2 * pi * i / n - 0.5 * pi;
+        ring.push(cos(a));
+        ring.push(sin(a));
+    }
+    return ring.begin();
+}
+
+const UnitSphere& unit_sphere(int m, int n) {
+    int key = m << 16 | n;
+    auto it = spheres.find(key);
+    if (it != spheres.end()) return it->second;
+    UnitSphere& sphere = spheres[key];
+
+    float* mercator = new float[n + 1];
+    for (int i = 1; i < n; i ++) {
+        float phi = (float(i) / n - 0.5f) * pi;
+        mercator[i] = fmin(10.0f, log(fabs(1 / cos(phi) + tan(phi))));
+    }
+    mercator[0] = -10.0f;
+    mercator[n] = 10.0f;
+    for (int i = 0; i <= n; i ++) mercator[i] += 10.0f;
+    float msum = 0;
+    for (int i = 0; i <= n; i ++) {
+        msum += mercator[i];
+        if (i > 1) mercator[i] += mercator[i - 1];
+    }
+    for (int i = 0; i <= n; i ++) mercator[i] /= msum;
+
+    for (int i = 0; i < m; i ++) {
+        for (int j = 0; j < n; j ++) {
+            float y1 = 2 * pi * i / m - 0.5 * pi, y2 = 2 * pi * (i + 1) / m - 0.5 * pi;
+            float p1 = pi * j / n - 0.5 * pi, p2 = pi * (j + 1) / n - 0.5 * pi;
+            float sy1 = sin(y1), cy1 = cos(y1), sy2 = sin(y2), cy2 = cos(y2);
+            float sp1 = sin(p1), cp1 = cos(p1), sp2 = sin(p2), cp2 = cos(p2);
+            sphere.norms.push((cp1 * sy1 + cp1 * sy2 + cp2 * sy2 + cp2 * sy1) / 4);
+            sphere.norms.push((sp1 + sp2) / 2);
+            sphere.norms.push((cp1 * cy1 + cp1 * cy2 + cp2 * cy2 + cp2 * cy1) / 4);
+
+            float corners[6][3] = {
+                { cp1 * sy1, sp1, cp1 * cy1 }, { cp1 * sy2, sp1, cp1 * cy2 }, { cp2 * sy2, sp2, cp2 * cy2 },
+                { cp2 * sy2, sp2, cp2 * cy2 }, { cp2 * sy1, sp2, cp2 * cy1 }, { cp1 * sy1, sp1, cp1 * cy1 }
+            };
+            for (const auto& c : corners) for (float f : c) sphere.pos.push(f);
+
+            float uvs[6][2] = {
+                { float(i) / m, mercator[j] }, { float(i + 1) / m, mercator[j] }, { float(i + 1) / m, mercator[j + 1] },
+                { float(i + 1) / m, mercator[j + 1] }, { float(i) / m, mercator[j + 1] }, { float(i) / m, mercator[j] }
+            };
+            for (const auto& uv : uvs) sphere.uvs.push(uv[0]), sphere.uvs.push(uv[1]);
+        }
+    }
+
+    delete[] mercator;
+    return sphere;
+}
+
+static int level(float sides) {
+    for (int i = 0; i < NUM_LEVELS; i ++) if (LEVELS[i] >= sides) return i;
+    return NUM_LEVELS - 1;
+}
+
+int lod_sides(float radius, int& current) {
+    float needed = pi * sqrt(fmax(radius, 0.0f) / (2 * TOLERANCE));
+    int up = level(needed), down = level(needed * HYSTERESIS);
+    if (current < 0 || up > current) current = up;
+    else if (down < current) current = down;
+    return LEVELS[current];
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef _LIBDRAW_LOD_H
+#define _LIBDRAW_LOD_H
+
+#include "lib/util/vec.h"
+
+// A sphere of radius 1 split into m slices around and n stacks from bottom to
+// top, as six vertices per quad. Each quad has one normal, and UVs spaced out
+// by a Mercator-like scale so textures aren't pinched toward the poles.
+struct UnitSphere {
+    vector<float> pos, norms, uvs;
+};
+
+// Unit meshes are built the first time each side count is asked for, and kept.
+// Rings hold the cosine and sine of each of n + 1 angles around a circle,
+// starting at the bottom.
+const float* unit_ring(int n);
+const UnitSphere& unit_sphere(int m, int n);
+
+// Picks how many sides a round shape needs to look round at the given radius
+// in pixels. level is the shape's level from last time, or -1, and is updated.
+int lod_sides(float radius, int& level);
+
+#endif
\ No newline at end of file
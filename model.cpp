@@ -1,20 +1,56 @@
 #include "model.h"
+#include "shader.h"
+#include "sort.h"
+#include "stats.h"
+#include "trace.h"
 #include "lib/util/io.h"
 
 static vector<Buffer> buffers;
 
 Buffer::Buffer():
-    dirty(true) {
+    dirty(true), occluder(false) {
     glGenBuffers(1, &vbuf);
     glGenBuffers(1, &cbuf);
     glGenBuffers(1, &nbuf);
     glGenBuffers(1, &tbuf);
     glGenBuffers(1, &sbuf);
+    glGenBuffers(1, &cubebuf);
+    glGenBuffers(1, &boardbuf);
 }
 
+static void extend(float lo[3], float hi[3], bool& first, const float* p) {
+    for (int k = 0; k < 3; k ++) {
+        if (first || p[k] < lo[k]) lo[k] = p[k];
+        if (first || p[k] > hi[k]) hi[k] = p[k];
+    }
+    first = false;
+}
+
+// The bounding box is kept so that whole models can be ordered by depth, or
+// tested for visibility, without looking at their geometry again.
 void Buffer::bake() {
+    trace_begin("bake");
     dirty = false;
 
+    for (int k = 0; k < 3; k ++) lo[k] = hi[k] = 0;
+    bool first = true;
+    for (u32 i = 0; i + 2 < verts.size(); i += 3) extend(lo, hi, first, &verts[i]);
+    // cube records hold a center and size; boards turn to face the camera,
+    // so they could reach as far as their larger side in any direction
+    for (u32 i = 0; i + CUBE_INSTANCE <= cubes.size(); i += CUBE_INSTANCE) {
+        const float* c = &cubes[i];
+        float a[3] = { c[0] - c[3] / 2, c[1] - c[4] / 2, c[2] - c[5] / 2 };
+        float b[3] = { c[0] + c[3] / 2, c[1] + c[4] / 2, c[2] + c[5] / 2 };
+        extend(lo, hi, first, a), extend(lo, hi, first, b);
+    }
+    for (u32 i = 0; i + BOARD_INSTANCE <= boards.size(); i += BOARD_INSTANCE) {
+        const float* c = &boards[i];
+        float r = c[3] > c[4] ? c[3] : c[4];
+        float a[3] = { c[0] - r, c[1] - r, c[2] - r }, b[3] = { c[0] + r, c[1] + r, c[2] + r };
+        extend(lo, hi, first, a), extend(lo, hi, first, b);
+    }
+    for (int k = 0; k < 3; k ++) center[k] = (lo[k] + hi[k]) / 2;
+
     glBindBuffer(GL_ARRAY_BUFFER, vbuf);
     glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(float), &verts[0], GL_DYNAMIC_DRAW);
     
@@ -30,15 +66,24 @@ void Buffer::bake() {
     glBindBuffer(GL_ARRAY_BUFFER, sbuf);
     glBufferData(GL_ARRAY_BUFFER, sprs.size() * sizeof(float), &sprs[0], GL_DYNAMIC_DRAW);
 
+    glBindBuffer(GL_ARRAY_BUFFER, cubebuf);
+    glBufferData(GL_ARRAY_BUFFER, cubes.size() * sizeof(float), &cubes[0], GL_DYNAMIC_DRAW);
+
+    glBindBuffer(GL_ARRAY_BUFFER, boardbuf);
+    glBufferData(GL_ARRAY_BUFFER, boards.size() * sizeof(float), &boards[0], GL_DYNAMIC_DRAW);
+
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+    framecounts.vertices += verts.size() / 3;
+    framecounts.bytes += (verts.size() + cols.size() + norms.size() + uvs.size() + sprs.size() + cubes.size() + boards.size()) * sizeof(float);
     if (verts.size() / 3 != cols.size() / 4 || verts.size() / 3 != norms.size() / 3
         || verts.size() / 3 != uvs.size() / 2 || verts.size() / 3 != sprs.size() / 4) {
         println("Incorrect buffer sizes.");
     }
+    trace_end();
 }
 
 bool Buffer::empty() const {
-    return verts.size() == 0;
+    return verts.size() == 0 && cubes.size() == 0 && boards.size() == 0;
 }
 
 void Buffer::reset() {
@@ -47,32 +92,98 @@ void Buffer::reset() {
     norms.clear();
     uvs.clear();
     sprs.clear();
+    cubes.clear();
+    boards.clear();
     dirty = true;
 }
 
-void Buffer::draw() {
-    if (dirty) bake();
-    int nverts = verts.size() / 3;
+// Instance attributes start right after the five per-vertex ones, and are
+// packed back to back in a single buffer.
+static void drawinstances(GLuint buf, const int* sizes, int nattribs, int stride, int nverts, int count) {
+    glBindBuffer(GL_ARRAY_BUFFER, buf);
+    int offset = 0;
+    for (int i = 0; i < nattribs; i ++) {
+        glEnableVertexAttribArray(5 + i);
+        glVertexAttribPointer(5 + i, sizes[i], GL_FLOAT, GL_FALSE, stride * sizeof(float), (const void*)(offset * sizeof(float)));
+        glVertexAttribDivisor(5 + i, 1);
+        offset += sizes[i];
+    }
+    glDrawArraysInstanced(GL_TRIANGLES, 0, nverts, count);
+    framecounts.drawcalls ++;
+    for (int i = 0; i < nattribs; i ++) {
+        glVertexAttribDivisor(5 + i, 0);
+        glDisableVertexAttribArray(5 + i);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
+static void bindvertices(const Buffer& buf) {
     for (int i = 0; i < 5; i ++) glEnableVertexAttribArray(i);
-    glBindBuffer(GL_ARRAY_BUFFER, vbuf);
+    glBindBuffer(GL_ARRAY_BUFFER, buf.vbuf);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
 
-    glBindBuffer(GL_ARRAY_BUFFER, cbuf);
+    glBindBuffer(GL_ARRAY_BUFFER, buf.cbuf);
     glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, nullptr);
 
-    glBindBuffer(GL_ARRAY_BUFFER, nbuf);
+    glBindBuffer(GL_ARRAY_BUFFER, buf.nbuf);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
 
-    glBindBuffer(GL_ARRAY_BUFFER, tbuf);
+    glBindBuffer(GL_ARRAY_BUFFER, buf.tbuf);
     glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
 
-    glBindBuffer(GL_ARRAY_BUFFER, sbuf);
+    glBindBuffer(GL_ARRAY_BUFFER, buf.sbuf);
     glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 0, nullptr);
+}
+
+void Buffer::draw() {
+    double start = stats_clock();
+    trace_begin("draw");
+    if (dirty) bake();
+    int nverts = verts.size() / 3;
 
+    bindvertices(*this);
     glDrawArrays(GL_TRIANGLES, 0, nverts);
+    framecounts.drawcalls ++;
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     for (int i = 0; i < 5; i ++) glDisableVertexAttribArray(i);
+
+    if (cubes.size()) {
+        static const int sizes[] = { 3, 3, 4, 4, 4, 4, 4, 3 };
+        bind_variant(VARIANT_CUBE);
+        drawinstances(cubebuf, sizes, 8, CUBE_INSTANCE, 36, cubes.size() / CUBE_INSTANCE);
+        bind_variant(VARIANT_BASE);
+    }
+    if (boards.size()) {
+        static const int sizes[] = { 3, 4, 4, 4 };
+        bind_variant(VARIANT_BOARD);
+        drawinstances(boardbuf, sizes, 4, BOARD_INSTANCE, 6, boards.size() / BOARD_INSTANCE);
+        bind_variant(VARIANT_BASE);
+    }
+    framecounts.submitms += stats_clock() - start;
+    trace_end();
+}
+
+// Draws the triangles once for each matrix, 16 floats apiece. The matrices go
+// through a buffer shared by every model, since they're uploaded fresh each
+// time. Instance records have instances of their own already, so they're
+// left to draw().
+void Buffer::drawplaced(const vector<float>& matrices) {
+    static GLuint matrixbuf = 0;
+    static const int sizes[] = { 4, 4, 4, 4 };
+    double start = stats_clock();
+    trace_begin("draw");
+    if (dirty) bake();
+    if (!matrixbuf) glGenBuffers(1, &matrixbuf);
+    glBindBuffer(GL_ARRAY_BUFFER, matrixbuf);
+    glBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(float), matrices.begin(), GL_STREAM_DRAW);
+
+    bindvertices(*this);
+    bind_variant(VARIANT_MODEL);
+    drawinstances(matrixbuf, sizes, 4, 16, verts.size() / 3, matrices.size() / 16);
+    bind_variant(VARIANT_BASE);
+    for (int i = 0; i < 5; i ++) glDisableVertexAttribArray(i);
+    framecounts.submitms += stats_clock() - start;
+    trace_end();
 }
 
 void Buffer::takefrom(const Buffer& buf, float dx, float dy, float dz, float r, float g, float b, float a) {
@@ -86,6 +197,60 @@ void Buffer::takefrom(const Buffer& buf, float dx, float dy, float dz, float r,
     for (float f : buf.norms) norms.push(f);
     for (float f : buf.uvs) uvs.push(f);
     for (float f : buf.sprs) sprs.push(f);
+
+    // instance records keep their position at 0 and their color at 6 or 7
+    for (u32 j = 0; j < buf.cubes.size(); j ++) {
+        int k = j % CUBE_INSTANCE;
+        cubes.push(buf.cubes[j] + (k < 3 ? ds[k] : k >= 6 && k < 10 ? color[k - 6] : 0));
+    }
+    for (u32 j = 0; j < buf.boards.size(); j ++) {
+        int k = j % BOARD_INSTANCE;
+        boards.push(buf.boards[j] + (k < 3 ? ds[k] : k >= 7 && k < 11 ? color[k - 7] : 0));
+    }
+}
+
+static float viewdepth(float modelview[4][4], float x, float y, float z) {
+    return -(x * modelview[0][2] + y * modelview[1][2] + z * modelview[2][2] + modelview[3][2]);
+}
+
+static void reorder(vector<float>& list, const vector<u32>& order, int size) {
+    static vector<float> sorted;
+    sorted.clear();
+    for (u32 i : order) for (int k = 0; k < size; k ++) sorted.push(list[i * size + k]);
+    for (u32 i = 0; i < sorted.size(); i ++) list[i] = sorted[i];
+}
+
+// Puts triangles and cube instances in order of their distance in front of the
+// camera, nearest first, so that the depth test rejects as much as possible.
+// Only worth it for geometry that's rebuilt every frame anyway, since the
+// buffer has to be uploaded again.
+void Buffer::sortdepth(float modelview[4][4]) {
+    static vector<float> keys;
+    static vector<u32> order;
+
+    keys.clear();
+    for (u32 i = 0; i + 8 < verts.size(); i += 9) {
+        const float* v = &verts[i];
+        keys.push(viewdepth(modelview, (v[0] + v[3] + v[6]) / 3, (v[1] + v[4] + v[7]) / 3, (v[2] + v[5] + v[8]) / 3));
+    }
+    if (keys.size() > 1) {
+        sortkeys(keys.begin(), keys.size(), order);
+        reorder(verts, order, 9);
+        reorder(cols, order, 12);
+        reorder(norms, order, 9);
+        reorder(uvs, order, 6);
+        reorder(sprs, order, 12);
+        dirty = true;
+    }
+
+    keys.clear();
+    for (u32 i = 0; i + CUBE_INSTANCE <= cubes.size(); i += CUBE_INSTANCE)
+        keys.push(viewdepth(modelview, cubes[i], cubes[i + 1], cubes[i + 2]));
+    if (keys.size() > 1) {
+        sortkeys(keys.begin(), keys.size(), order);
+        reorder(cubes, order, CUBE_INSTANCE);
+        dirty = true;
+    }
 }
 
 void Buffer::pos(float x, float y, float z) {
@@ -124,6 +289,11 @@ void Buffer::norm(float x, float y, float z) {
     norms.push(z);
 }
 
+void Buffer::instance(vector<float>& list, const float* record, int size) {
+    dirty = true;
+    for (int i = 0; i < size; i ++) list.push(record[i]);
+}
+
 Buffer& findbuf(Model handle) {
     return buffers[handle];
 }
@@ -5,16 +5,37 @@
 #include "lib/util/vec.h"
 #include "lib/GLAD/glad.h"
 
+// Sizes of the per-instance records read by the cube and board variants of a
+// shader. See CUBE_VSH and BOARD_VSH in shader.cpp for the layouts.
+enum InstanceSize {
+    CUBE_INSTANCE = 29,
+    BOARD_INSTANCE = 15
+};
+
 struct Buffer {
     vector<float> verts, cols, norms, uvs, sprs;
+    vector<float> cubes, boards;
     GLuint vbuf, cbuf, nbuf, tbuf, sbuf;
-    bool dirty;
+    GLuint cubebuf, boardbuf;
+    float lo[3], hi[3], center[3];
+    bool dirty, occluder;
+    // simpler versions of this model, each with about half the triangles of
+    // the one before, drawn in its place once it's small enough on screen
+    vector<Model> lods;
+    // flat pictures of this model from evenly spaced angles around it, each a
+    // model holding one board textured from impostorimg, drawn in its place
+    // from farther away than impostordistance
+    vector<Model> impostors;
+    Image impostorimg;
+    float impostordistance;
 
     Buffer();
     void bake();
     bool empty() const;
     void reset();
     void draw();
+    void drawplaced(const vector<float>& matrices);
+    void sortdepth(float modelview[4][4]);
     void takefrom(const Buffer& buf, float dx, float dy, float dz, float r, float g, float b, float a);
 
     void pos(float x, float y, float z);
@@ -22,6 +43,7 @@ struct Buffer {
     void uv(float u, float v);
     void spr(float x, float y, float w, float h);
     void norm(float x, float y, float z);
+    void instance(vector<float>& list, const float* record, int size);
 };
 
 Buffer& findbuf(Model model);
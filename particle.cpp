@@ -0,0 +1,236 @@
+#include "particle.h"
+#include "image.h"
+#include "shader.h"
+#include "stats.h"
+#include "lib/util/io.h"
+#include "lib/util/str.h"
+
+// Each particle is 12 floats: position, velocity, (age, lifetime), and color.
+static const int PARTICLE_FLOATS = 12;
+static const int MAX_SPAWNS = 16;
+
+static vector<EmitterMeta> emitters;
+static GLuint updateprog;
+static GLint u_dt, u_gravity, u_capacity, u_nspawns, u_spawn_range, u_spawn_pos, u_spawn_vel, u_spawn_col;
+
+// Advances every particle by one step, and replaces the particles in each
+// pending spawn range with new ones. Runs with rasterization disabled, and
+// writes its outputs back through transform feedback.
+static const char* UPDATE_VSH = R"(
+    #version 330
+    layout(location=0) in vec3 pos;
+    layout(location=1) in vec3 vel;
+    layout(location=2) in vec2 life;
+    layout(location=3) in vec4 col;
+
+    uniform float dt;
+    uniform vec3 gravity;
+    uniform int capacity;
+    uniform int nspawns;
+    uniform vec4 spawn_range[16];
+    uniform vec4 spawn_pos[16];
+    uniform vec4 spawn_vel[16];
+    uniform vec4 spawn_col[16];
+
+    out vec3 o_pos;
+    out vec3 o_vel;
+    out vec2 o_life;
+    out vec4 o_col;
+
+    float rand(uint n) {
+        n = (n << 13u) ^ n;
+        n = n * (n * n * 15731u + 789221u) + 1376312589u;
+        return float(n & 0x7fffffffu) / float(0x7fffffff);
+    }
+
+    void main() {
+        o_pos = pos + vel * dt;
+        o_vel = vel + gravity * dt;
+        o_life = vec2(life.x + dt, life.y);
+        o_col = o_life.x < o_life.y ? col : vec4(col.rgb, 0.0);
+
+        for (int i = 0; i < nspawns; i ++) {
+            int rel = (gl_VertexID - int(spawn_range[i].x) + capacity) % capacity;
+            if (rel >= int(spawn_range[i].y)) continue;
+            uint seed = uint(gl_VertexID) * 3u + uint(spawn_range[i].z) * 7919u;
+            float theta = 6.2831853 * rand(seed), z = 2.0 * rand(seed + 1u) - 1.0;
+            vec3 dir = vec3(sqrt(1.0 - z * z) * cos(theta), z, sqrt(1.0 - z * z) * sin(theta));
+            o_pos = spawn_pos[i].xyz;
+            o_vel = spawn_vel[i].xyz + dir * spawn_pos[i].w * rand(seed + 2u);
+            o_life = vec2(0.0, spawn_range[i].w);
+            o_col = spawn_col[i];
+        }
+    }
+)";
+
+EmitterMeta& findemitter(Emitter emitter) {
+    return emitters[emitter];
+}
+
+void init_particles() {
+    GLuint vsh = glCreateShader(GL_VERTEX_SHADER);
+    GLint size = string(UPDATE_VSH).size();
+    glShaderSource(vsh, 1, &UPDATE_VSH, &size);
+    glCompileShader(vsh);
+
+    GLint status = GL_TRUE;
+    if (glGetShaderiv(vsh, GL_COMPILE_STATUS, &status), !status) {
+        char log[1024];
+        GLsizei length = 0;
+        glGetShaderInfoLog(vsh, 1024, &length, log);
+        println("Particle shader error:\n", (const char*)log);
+    }
+
+    static const char* varyings[] = { "o_pos", "o_vel", "o_life", "o_col" };
+    updateprog = glCreateProgram();
+    glAttachShader(updateprog, vsh);
+    glTransformFeedbackVaryings(updateprog, 4, varyings, GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(updateprog);
+
+    u_dt = glGetUniformLocation(updateprog, "dt");
+    u_gravity = glGetUniformLocation(updateprog, "gravity");
+    u_capacity = glGetUniformLocation(updateprog, "capacity");
+    u_nspawns = glGetUniformLocation(updateprog, "nspawns");
+    u_spawn_range = glGetUniformLocation(updateprog, "spawn_range");
+    u_spawn_pos = glGetUniformLocation(updateprog, "spawn_pos");
+    u_spawn_vel = glGetUniformLocation(updateprog, "spawn_vel");
+    u_spawn_col = glGetUniformLocation(updateprog, "spawn_col");
+}
+
+void spawn(Emitter emitter, const SpawnBatch& batch) {
+    EmitterMeta& meta = findemitter(emitter);
+    SpawnBatch b = batch;
+    if (b.count > meta.capacity) b.count = meta.capacity;
+    if (b.count <= 0) return;
+    b.start = meta.head;
+    meta.head = (meta.head + b.count) % meta.capacity;
+    meta.pending.push(b);
+}
+
+static void attribs(GLuint buf, int first) {
+    glBindBuffer(GL_ARRAY_BUFFER, buf);
+    static const int sizes[] = { 3, 3, 2, 4 };
+    int offset = 0;
+    for (int i = 0; i < 4; i ++) {
+        glEnableVertexAttribArray(first + i);
+        glVertexAttribPointer(first + i, sizes[i], GL_FLOAT, GL_FALSE, PARTICLE_FLOATS * sizeof(float), (const void*)(offset * sizeof(float)));
+        offset += sizes[i];
+    }
+}
+
+static void pass(EmitterMeta& meta, float dt, int first, int n) {
+    float range[MAX_SPAWNS * 4], pos[MAX_SPAWNS * 4], vel[MAX_SPAWNS * 4], col[MAX_SPAWNS * 4];
+    for (int i = 0; i < n; i ++) {
+        const SpawnBatch& b = meta.pending[first + i];
+        range[i * 4] = b.start, range[i * 4 + 1] = b.count, range[i * 4 + 2] = meta.lastframe + i, range[i * 4 + 3] = b.life;
+        pos[i * 4] = b.x, pos[i * 4 + 1] = b.y, pos[i * 4 + 2] = b.z, pos[i * 4 + 3] = b.spread;
+        vel[i * 4] = b.vx, vel[i * 4 + 1] = b.vy, vel[i * 4 + 2] = b.vz, vel[i * 4 + 3] = 0;
+        col[i * 4] = b.r, col[i * 4 + 1] = b.g, col[i * 4 + 2] = b.b, col[i * 4 + 3] = b.a;
+    }
+    glUniform1f(u_dt, dt);
+    glUniform1i(u_nspawns, n);
+    if (n) {
+        glUniform4fv(u_spawn_range, n, range);
+        glUniform4fv(u_spawn_pos, n, pos);
+        glUniform4fv(u_spawn_vel, n, vel);
+        glUniform4fv(u_spawn_col, n, col);
+    }
+
+    attribs(meta.state[meta.current], 0);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, meta.state[1 - meta.current]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, meta.capacity);
+    framecounts.drawcalls ++;
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    for (int i = 0; i < 4; i ++) glDisableVertexAttribArray(i);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    meta.current = 1 - meta.current;
+}
+
+// Updates at most once a frame, however many times the emitter is drawn. If
+// more batches are pending than fit in one pass, the rest are spawned in
+// extra passes that don't advance time.
+void update_emitter(Emitter emitter) {
+    EmitterMeta& meta = findemitter(emitter);
+    if (meta.lastframe == LIBDRAW_SYMBOL(frames)()) return;
+    double now = LIBDRAW_SYMBOL(seconds)();
+    float dt = meta.lastframe < 0 ? 0 : now - meta.lasttime;
+    meta.lastframe = LIBDRAW_SYMBOL(frames)(), meta.lasttime = now;
+
+    glUseProgram(updateprog);
+    glUniform3f(u_gravity, meta.gx, meta.gy, meta.gz);
+    glUniform1i(u_capacity, meta.capacity);
+    glEnable(GL_RASTERIZER_DISCARD);
+    int first = 0;
+    do {
+        int n = meta.pending.size() - first;
+        if (n > MAX_SPAWNS) n = MAX_SPAWNS;
+        pass(meta, first ? 0 : dt, first, n);
+        first += n;
+    } while (first < (int)meta.pending.size());
+    glDisable(GL_RASTERIZER_DISCARD);
+    meta.pending.clear();
+    rebind();
+}
+
+// Particles are drawn as boards, reading position and color straight from the
+// state buffer. The size and sprite rectangle are the same for every particle,
+// so they're passed as constant attributes.
+void draw_emitter(Emitter emitter) {
+    EmitterMeta& meta = findemitter(emitter);
+    ImageMeta* root = &findimg(meta.img);
+    while (root->parent > 0) root = &findimg(root->parent);
+    const ImageMeta& img = findimg(meta.img);
+
+    bind_variant(VARIANT_BOARD);
+    glBindBuffer(GL_ARRAY_BUFFER, meta.state[meta.current]);
+    glEnableVertexAttribArray(5);
+    glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, PARTICLE_FLOATS * sizeof(float), nullptr);
+    glVertexAttribDivisor(5, 1);
+    glEnableVertexAttribArray(7);
+    glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, PARTICLE_FLOATS * sizeof(float), (const void*)(8 * sizeof(float)));
+    glVertexAttribDivisor(7, 1);
+    glVertexAttrib4f(6, img.w, img.h, 0.5f, 0.5f);
+    glVertexAttrib4f(8, float(img.x) / root->w, float(img.y) / root->h, float(img.w) / root->w, float(img.h) / root->h);
+
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, meta.capacity);
+    framecounts.drawcalls ++;
+
+    glVertexAttribDivisor(5, 0);
+    glVertexAttribDivisor(7, 0);
+    glDisableVertexAttribArray(5);
+    glDisableVertexAttribArray(7);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bind_variant(VARIANT_BASE);
+}
+
+extern "C" Emitter LIBDRAW_SYMBOL(emitter)(int capacity, Image img) {
+    if (capacity <= 0) {
+        println("Tried to create an emitter with no capacity!");
+        capacity = 1;
+    }
+
+    emitters.push({});
+    EmitterMeta& meta = emitters.back();
+    meta.img = img;
+    meta.capacity = capacity, meta.head = 0, meta.current = 0;
+    meta.gx = meta.gy = meta.gz = 0;
+    meta.lastframe = -1, meta.lasttime = 0;
+
+    // zeroed particles have already outlived their lifetime of zero
+    float* zeroes = new float[capacity * PARTICLE_FLOATS]();
+    glGenBuffers(2, meta.state);
+    for (int i = 0; i < 2; i ++) {
+        glBindBuffer(GL_ARRAY_BUFFER, meta.state[i]);
+        glBufferData(GL_ARRAY_BUFFER, capacity * PARTICLE_FLOATS * sizeof(float), zeroes, GL_DYNAMIC_COPY);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    delete[] zeroes;
+    return emitters.size() - 1;
+}
+
+extern "C" void LIBDRAW_SYMBOL(gravity)(Emitter e, float x, float y, float z) {
+    EmitterMeta& meta = findemitter(e);
+    meta.gx = x, meta.gy = y, meta.gz = z;
+}
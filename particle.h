@@ -0,0 +1,33 @@
+#ifndef _LIBDRAW_PARTICLE_H
+#define _LIBDRAW_PARTICLE_H
+
+#include "draw.h"
+#include "lib/util/vec.h"
+#include "lib/GLAD/glad.h"
+
+// A batch of particles requested by a single emit() call. Batches are applied
+// on the GPU the next time the emitter is updated.
+struct SpawnBatch {
+    int start, count;
+    float x, y, z, vx, vy, vz, spread, life;
+    float r, g, b, a;
+};
+
+struct EmitterMeta {
+    Image img;
+    int capacity, head;
+    GLuint state[2];
+    int current;
+    float gx, gy, gz;
+    int lastframe;
+    double lasttime;
+    vector<SpawnBatch> pending;
+};
+
+EmitterMeta& findemitter(Emitter emitter);
+void spawn(Emitter emitter, const SpawnBatch& batch);
+void update_emitter(Emitter emitter);
+void draw_emitter(Emitter emitter);
+void init_particles();
+
+#endif
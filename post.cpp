@@ -0,0 +1,218 @@
+#include "post.h"
+#include "image.h"
+#include "shader.h"
+#include "fbo.h"
+#include "stats.h"
+#include "lib/GLAD/glad.h"
+#include "lib/util/io.h"
+#include "stdio.h"
+
+static vector<PostGraphMeta> graphs;
+
+PostGraphMeta& findgraph(PostGraph graph) {
+    return graphs[graph];
+}
+
+extern "C" PostGraph LIBDRAW_SYMBOL(postgraph)() {
+    graphs.push({});
+    graphs.back().compiled = false;
+    return graphs.size() - 1;
+}
+
+static int addpass(PostGraph graph, const PostPass& pass) {
+    PostGraphMeta& meta = findgraph(graph);
+    for (int i = 0; i < pass.ninputs; i ++) if (pass.inputs[i] >= (int)meta.passes.size()) {
+        println("Post-processing passes can only read from earlier passes!");
+        return -1;
+    }
+    meta.passes.push(pass);
+    meta.compiled = false;
+    return meta.passes.size() - 1;
+}
+
+extern "C" int LIBDRAW_SYMBOL(postpass)(PostGraph graph, Shader shader, int input, ImageFormat format, float scale) {
+    return addpass(graph, { shader, string(), false, { input }, 1, format, scale });
+}
+
+extern "C" int LIBDRAW_SYMBOL(postpixel)(PostGraph graph, const char* body, int input, ImageFormat format) {
+    return addpass(graph, { LIBDRAW_CONST(DEFAULT_SHADER), string(body), true, { input }, 1, format, 1 });
+}
+
+extern "C" void LIBDRAW_SYMBOL(postinput)(PostGraph graph, int pass, int input) {
+    PostGraphMeta& meta = findgraph(graph);
+    PostPass& p = meta.passes[pass];
+    if (p.ispixel || p.ninputs == MAX_POST_INPUTS || input >= pass) {
+        println("Could not add input to post-processing pass ", pass, ".");
+        return;
+    }
+    p.inputs[p.ninputs ++] = input;
+    meta.compiled = false;
+}
+
+// Builds a single fragment shader out of a chain of pixel passes. Each pass
+// becomes a function of the previous one's color.
+static Shader fuse(const vector<PostPass>& passes, const vector<int>& chain) {
+    string src = R"(
+    #version 330
+    in vec4 v_col;
+    in vec2 v_uv;
+    in vec4 v_spr;
+    in vec4 v_pos;
+
+    uniform sampler2D tex;
+    uniform int width, height;
+
+    out vec4 color;
+    )";
+    char index[16];
+    for (u32 i = 0; i < chain.size(); i ++) {
+        snprintf(index, sizeof(index), "%u", i);
+        src += "\n    vec4 pixel";
+        src += index;
+        src += "(vec4 color) {\n";
+        src += passes[chain[i]].pixel;
+        src += "\n    }\n";
+    }
+    src += "\n    void main() {\n        vec4 c = texture(tex, v_uv);\n";
+    for (u32 i = 0; i < chain.size(); i ++) {
+        snprintf(index, sizeof(index), "%u", i);
+        src += "        c = pixel";
+        src += index;
+        src += "(c);\n";
+    }
+    src += "        color = c;\n    }\n";
+    return LIBDRAW_SYMBOL(shader)(LIBDRAW_CONST(DEFAULT_VSH), (const char*)src.raw());
+}
+
+// Merges each pixel pass into the stage of its input, when that input is a
+// pixel pass nothing else reads. Passes are declared in dependency order, so
+// stages come out in an order that can be run front to back. Shaders fused by
+// an earlier compile are freed first.
+extern "C" void LIBDRAW_SYMBOL(compilepost)(PostGraph graph) {
+    PostGraphMeta& meta = findgraph(graph);
+    const vector<PostPass>& passes = meta.passes;
+    for (const PostStage& stage : meta.stages) if (stage.fused) free_shader(stage.shader);
+    meta.stages.clear();
+
+    vector<int> readers, stageof;
+    for (u32 i = 0; i < passes.size(); i ++) readers.push(0), stageof.push(-1);
+    for (const PostPass& p : passes) for (int i = 0; i < p.ninputs; i ++) if (p.inputs[i] >= 0) readers[p.inputs[i]] ++;
+
+    vector<vector<int>> chains;
+    for (u32 i = 0; i < passes.size(); i ++) {
+        const PostPass& p = passes[i];
+        int in = p.inputs[0];
+        if (p.ispixel && in >= 0 && passes[in].ispixel && readers[in] == 1) {
+            stageof[i] = stageof[in];
+            chains[stageof[i]].push(i);
+            PostStage& stage = meta.stages[stageof[i]];
+            stage.format = p.format;
+            continue;
+        }
+
+        PostStage stage;
+        stage.shader = p.shader;
+        stage.fused = false;
+        stage.ninputs = p.ninputs;
+        for (int j = 0; j < p.ninputs; j ++) stage.inputs[j] = p.inputs[j] < 0 ? -1 : stageof[p.inputs[j]];
+        stage.format = p.format;
+        stage.scale = p.scale;
+        stage.last = -1;
+        stageof[i] = meta.stages.size();
+        meta.stages.push(stage);
+        chains.push({});
+        chains.back().push(i);
+    }
+
+    for (u32 i = 0; i < meta.stages.size(); i ++) {
+        PostStage& stage = meta.stages[i];
+        if (passes[chains[i][0]].ispixel) stage.shader = fuse(passes, chains[i]), stage.fused = true;
+        for (int j = 0; j < stage.ninputs; j ++) if (stage.inputs[j] >= 0) meta.stages[stage.inputs[j]].last = i;
+    }
+    meta.output = passes.size() ? stageof[passes.size() - 1] : -1;
+    meta.compiled = true;
+}
+
+// Fullscreen passes draw with blending, depth testing and culling off, and
+// put back the target, shader and texture that were bound before.
+PassState beginpasses() {
+    PassState state;
+    state.fbo = currentfbo();
+    state.shader = active_shader();
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &state.tex);
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    return state;
+}
+
+void endpasses(const PassState& state) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, state.tex);
+    glEnable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    bind(state.shader);
+    bindfbo(state.fbo, true);
+}
+
+// Binds everything a pass needs, so that only its own uniforms are left to set
+// before endpass() draws it. The first input is bound to "tex", and the rest
+// to "tex1", "tex2" and so on.
+void beginpass(Shader shader, const Image* inputs, int ninputs, Image out) {
+    LIBDRAW_SYMBOL(loadaction)(out, LIBDRAW_CONST(DISCARD_LOAD), LIBDRAW_CONST(DISCARD_LOAD));
+    bindfbo(out);
+    bind(shader);
+    bind_variant(VARIANT_FULLSCREEN);
+    for (int j = ninputs - 1; j >= 0; j --) {
+        glActiveTexture(GL_TEXTURE0 + j);
+        glBindTexture(GL_TEXTURE_2D, findimg(inputs[j]).id);
+        framecounts.texturebinds ++;
+        if (j > 0) {
+            char name[16];
+            snprintf(name, sizeof(name), "tex%d", j);
+            glUniform1i(find_uniform(name), j);
+        }
+    }
+}
+
+void endpass() {
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    framecounts.drawcalls ++;
+    bind_variant(VARIANT_BASE);
+}
+
+// Runs every stage of the graph on the source image, and returns the output
+// of the last pass declared. Intermediate images come from the render target
+// pool, and each is released as soon as its last reader is done, so stages
+// whose lifetimes don't overlap end up sharing textures. Stages nothing reads
+// are released right away.
+extern "C" Image LIBDRAW_SYMBOL(runpost)(PostGraph graph, Image source) {
+    PostGraphMeta& meta = findgraph(graph);
+    if (!meta.compiled) LIBDRAW_SYMBOL(compilepost)(graph);
+    if (meta.stages.size() == 0) return source;
+
+    PassState state = beginpasses();
+    vector<Image> outputs;
+    for (u32 i = 0; i < meta.stages.size(); i ++) {
+        const PostStage& stage = meta.stages[i];
+        Image inputs[MAX_POST_INPUTS];
+        for (int j = 0; j < stage.ninputs; j ++) inputs[j] = stage.inputs[j] < 0 ? source : outputs[stage.inputs[j]];
+        int w = LIBDRAW_SYMBOL(width)(inputs[0]) * stage.scale, h = LIBDRAW_SYMBOL(height)(inputs[0]) * stage.scale;
+        if (w < 1) w = 1;
+        if (h < 1) h = 1;
+
+        Image out = LIBDRAW_SYMBOL(target)(w, h, stage.format, false);
+        outputs.push(out);
+        beginpass(stage.shader, inputs, stage.ninputs, out);
+        endpass();
+
+        for (int j = 0; j < stage.ninputs; j ++) {
+            int in = stage.inputs[j];
+            if (in >= 0 && in != meta.output && meta.stages[in].last == (int)i) LIBDRAW_SYMBOL(release)(outputs[in]);
+        }
+        if (stage.last < 0 && (int)i != meta.output) LIBDRAW_SYMBOL(release)(out);
+    }
+    endpasses(state);
+    return outputs[meta.output];
+}
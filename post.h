@@ -0,0 +1,54 @@
+#ifndef _LIBDRAW_POST_H
+#define _LIBDRAW_POST_H
+
+#include "draw.h"
+#include "lib/util/vec.h"
+#include "lib/util/str.h"
+
+static const int MAX_POST_INPUTS = 4;
+
+// A pass as it was declared. Pixel passes only have a function body, which
+// gets merged with neighboring pixel passes when the graph is compiled.
+struct PostPass {
+    Shader shader;
+    string pixel;
+    bool ispixel;
+    int inputs[MAX_POST_INPUTS], ninputs;
+    ImageFormat format;
+    float scale;
+};
+
+// A pass as it's actually run. Inputs refer to earlier stages, and last is
+// the final stage reading this one's output.
+struct PostStage {
+    Shader shader;
+    bool fused;
+    int inputs[MAX_POST_INPUTS], ninputs;
+    ImageFormat format;
+    float scale;
+    int last;
+};
+
+// output is the stage the last declared pass ended up in, which needn't be
+// the last stage once pixel passes are fused into earlier ones.
+struct PostGraphMeta {
+    vector<PostPass> passes;
+    vector<PostStage> stages;
+    int output;
+    bool compiled;
+};
+
+// What beginpasses() changed, to be put back by endpasses().
+struct PassState {
+    Image fbo;
+    Shader shader;
+    int tex;
+};
+
+PostGraphMeta& findgraph(PostGraph graph);
+PassState beginpasses();
+void endpasses(const PassState& state);
+void beginpass(Shader shader, const Image* inputs, int ninputs, Image out);
+void endpass();
+
+#endif
\ No newline at end of file
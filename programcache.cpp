@@ -0,0 +1,107 @@
+#include "programcache.h"
+#include "lib/GLFW/glfw3.h"
+#include "lib/util/str.h"
+#include "lib/util/io.h"
+#include "stdio.h"
+
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei size, GLsizei* length, GLenum* format, void* binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum format, const void* binary, GLsizei length);
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+static GetProgramBinaryProc getbinary = nullptr;
+static ProgramBinaryProc putbinary = nullptr;
+static ProgramParameteriProc parameteri = nullptr;
+
+static string directory;
+static u64 driver;
+
+// Identifies each file as a program binary, in case the directory is shared.
+static const u32 MAGIC = 0x4C445042;
+
+static u64 fnv(u64 hash, const char* s) {
+    if (s) for (; *s; s ++) hash = (hash ^ (u8)*s) * 0x100000001b3ull;
+    return (hash ^ 0xff) * 0x100000001b3ull;
+}
+
+extern "C" void LIBDRAW_SYMBOL(shadercache)(const char* dir) {
+    directory = dir ? dir : "";
+}
+
+void init_program_cache() {
+    if (glfwExtensionSupported("GL_ARB_get_program_binary")) {
+        getbinary = (GetProgramBinaryProc)glfwGetProcAddress("glGetProgramBinary");
+        putbinary = (ProgramBinaryProc)glfwGetProcAddress("glProgramBinary");
+        parameteri = (ProgramParameteriProc)glfwGetProcAddress("glProgramParameteri");
+    }
+    driver = 0xcbf29ce484222325ull;
+    driver = fnv(driver, (const char*)glGetString(GL_VENDOR));
+    driver = fnv(driver, (const char*)glGetString(GL_RENDERER));
+    driver = fnv(driver, (const char*)glGetString(GL_VERSION));
+}
+
+static bool enabled() {
+    return directory.size() > 0 && getbinary && putbinary && parameteri;
+}
+
+u64 program_key(const char* vsrc, const char* fsrc, const char* prologue) {
+    return fnv(fnv(fnv(driver, vsrc), fsrc), prologue);
+}
+
+static FILE* cachefile(u64 key, const char* mode) {
+    char name[24];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+    string path = directory;
+    path += name;
+    return fopen((const char*)path.raw(), mode);
+}
+
+// Returns 0 if the program isn't cached, or the driver won't take the binary
+// back, in which case the caller links from source and saves it again.
+GLuint load_program(u64 key) {
+    if (!enabled()) return 0;
+    FILE* f = cachefile(key, "rb");
+    if (!f) return 0;
+
+    u32 header[3];
+    GLuint program = 0;
+    if (fread(header, sizeof(u32), 3, f) == 3 && header[0] == MAGIC) {
+        u8* binary = new u8[header[2]];
+        if (fread(binary, 1, header[2], f) == header[2]) {
+            program = glCreateProgram();
+            putbinary(program, header[1], binary, header[2]);
+            GLint status = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &status);
+            if (!status) glDeleteProgram(program), program = 0;
+        }
+        delete[] binary;
+    }
+    fclose(f);
+    return program;
+}
+
+// Must be called before linking, or some drivers won't keep the binary.
+void prepare_program(GLuint program) {
+    if (enabled()) parameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void save_program(u64 key, GLuint program) {
+    if (!enabled()) return;
+    GLint length = 0, status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!status || length <= 0) return;
+
+    u8* binary = new u8[length];
+    GLenum format;
+    getbinary(program, length, &length, &format, binary);
+    if (FILE* f = cachefile(key, "wb")) {
+        u32 header[3] = { MAGIC, format, (u32)length };
+        if (fwrite(header, sizeof(u32), 3, f) != 3 || fwrite(binary, 1, length, f) != (size_t)length)
+            println("Could not write program binary to ", (const char*)directory.raw(), ".");
+        fclose(f);
+    }
+    delete[] binary;
+}
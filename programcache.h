@@ -0,0 +1,17 @@
+#ifndef _LIBDRAW_PROGRAMCACHE_H
+#define _LIBDRAW_PROGRAMCACHE_H
+
+#include "draw.h"
+#include "lib/GLAD/glad.h"
+#include "lib/util/defs.h"
+
+// Linked programs are saved by key in the directory given to shadercache(),
+// so later runs can skip compiling them. Keys cover the sources and the
+// driver, since binaries are only valid for the driver that made them.
+void init_program_cache();
+u64 program_key(const char* vsrc, const char* fsrc, const char* prologue);
+GLuint load_program(u64 key);
+void prepare_program(GLuint program);
+void save_program(u64 key, GLuint program);
+
+#endif
\ No newline at end of file
@@ -5,8 +5,19 @@
 #include "image.h"
 #include "shader.h"
 #include "fbo.h"
+#include "tilemap.h"
+#include "particle.h"
+#include "light.h"
+#include "sort.h"
+#include "hiz.h"
+#include "scene.h"
+#include "lod.h"
+#include "stats.h"
+#include "timer.h"
+#include "trace.h"
 #include "lib/util/io.h"
 #include "lib/util/vec.h"
+#include "lib/util/hash.h"
 
 static GLuint texture;
 static Origin orig;
@@ -15,12 +26,108 @@ static float pi = 3.14159265358979323f;
 static float red = 1, green = 1, blue = 1, alpha = 1;
 static float lightx = 0.218218, lighty = -0.872872, lightz = 0.436436;
 static bool mode3d = false;
+static bool instanced = false;
 static Model rendermodel;
 bool invert = false;
 static float near = 0, far = 0;
 static float yaw = 0, pitch = 0, roll = 0;
 static float camerax = 0, cameray = 0, cameraz = 0;
 static Image currentfont;
+static bool shadowed = false, hasshadows = false;
+static bool fogged = false;
+static float shadowmatrix[4][4];
+static Shader shadowshader;
+static GLuint shadowsampler;
+static bool depthsorted = false, prepassed = false;
+
+// What to do about drawing a model: skip it, draw it only if the GPU finds
+// that its query passed, or just draw it.
+struct Occlusion {
+    bool hidden;
+    GLuint condition;
+};
+
+// Baked models held back by depth sorting, with the transform each was
+// rendered with.
+struct Deferred {
+    Model model;
+    Image img;
+    float transform[4][4];
+    Occlusion occlusion;
+};
+
+static vector<Deferred> deferred;
+
+// Translucent 3D primitives are kept with the state they were drawn with, and
+// drawn back to front after everything opaque.
+struct Translucent {
+    Step step;
+    float transform[4][4];
+    float color[4];
+    Origin orig;
+};
+
+static vector<Translucent> translucents;
+static bool translucency = false;
+
+// Occlusion queries are kept for each model and each time it's rendered in a
+// frame, so a model rendered in several places gets a query for each. Slots
+// alternate between two queries, so one can be read while the other is drawn.
+struct OcclusionSlot {
+    GLuint queries[2];
+    int next;
+    u32 frame;
+};
+
+// A bounding box to draw for a query, once everything opaque is drawn.
+struct Proxy {
+    GLuint query;
+    float matrix[4][4];
+};
+
+static const float PROXY_MARGIN = 1.0f / 256;
+static bool occluding = false, shadowpass = false;
+static vector<Step> shadowcamera;
+static map<u64, OcclusionSlot> occlusionslots;
+static vector<u32> rendercounts;
+static vector<Proxy> proxies;
+static Model proxymodel;
+static u32 occlusionframe = 1;
+static int occluded_count = 0, occluded_last = 0;
+static float hizcamera[4][4];
+
+// Round shapes drawn with automatic detail remember their level between
+// frames, matched up by the order they're drawn in, like occlusion queries.
+static bool autodetail = false;
+static vector<int> lodlevels;
+static u32 lodcount = 0;
+
+// While overdraw is being measured, fragments that pass the depth test are
+// counted with queries. Like GPU timers, they're read back a few frames late,
+// and a frame whose queries still aren't done by then is dropped, so nothing
+// waits on the GPU.
+static const int OVERDRAW_FRAMES = 4;
+static bool sampling = false, counting = false;
+static vector<GLuint> samplequeries[OVERDRAW_FRAMES], freequeries;
+static double framepixels[OVERDRAW_FRAMES];
+static u32 sampleslot = 0;
+static float overdraw_last = 0;
+
+// Only depth is written while drawing a shadow map, but textures with
+// transparent holes still have to leave holes in their shadows.
+static const char* SHADOW_FSH = R"(
+    #version 330
+    in vec4 v_col;
+    in vec2 v_uv;
+    in vec4 v_spr;
+    uniform sampler2D tex;
+
+    void main() {
+        vec2 fract_uv = fract(v_uv);
+        vec2 fixed_uv = vec2(v_spr.x + v_spr.z * fract_uv.x, v_spr.y + v_spr.w * fract_uv.y);
+        if (v_col.a * texture(tex, fixed_uv).a <= 0.00390625) discard;
+    }
+)";
 
 struct mat4 {
     float data[4][4];
@@ -140,12 +247,89 @@ static void frustum(float matrix[4][4], float w, float h, float fov) {
 
 static vector<Step> steps;
 
+static StepKind stepkind(StepType type) {
+    switch (type) {
+        case STEP_RECT:
+        case STEP_POLYGON:
+        case STEP_SPRITE:
+        case STEP_TEXT:
+        case STEP_WRAPPED_TEXT:
+        case STEP_TILEMAP:
+            return LIBDRAW_CONST(DRAWING_STEPS);
+        case STEP_CUBE:
+        case STEP_BOARD:
+        case STEP_SLANT:
+        case STEP_PRISM:
+        case STEP_CONE:
+        case STEP_HEDRON:
+            return LIBDRAW_CONST(SHAPE_STEPS);
+        case STEP_RENDER:
+        case STEP_INSTANCES:
+        case STEP_EMIT:
+        case STEP_PARTICLES:
+            return LIBDRAW_CONST(MODEL_STEPS);
+        case STEP_ORTHO:
+        case STEP_FRUSTUM:
+        case STEP_PAN:
+        case STEP_TILT:
+        case STEP_LOOK:
+            return LIBDRAW_CONST(CAMERA_STEPS);
+        case STEP_ROTATE:
+        case STEP_SCALE:
+        case STEP_TRANSLATE:
+        case STEP_BEGIN:
+        case STEP_END:
+            return LIBDRAW_CONST(TRANSFORM_STEPS);
+        default:
+            return LIBDRAW_CONST(STATE_STEPS);
+    }
+}
+
+// Timing each step would cost more than queueing it, so the queue is timed as
+// a whole, from its first step until it's drawn.
+static double queuestart;
+
 void enqueue(const Step& step) {
+    if (steps.size() == 0) queuestart = stats_clock();
     steps.push(step);
+    framecounts.steps[stepkind(step.type)] ++;
+}
+
+// The smallest specialization of the default fragment shader that can still
+// draw the current state. Alpha only needs discarding where depth is written,
+// and untextured geometry is drawn with the blank white texture.
+static int select_features(int lights) {
+    int features = 0;
+    if (texture != findimg(BLANK).id) features |= FEATURE_TEXTURE;
+    if (mode3d) features |= FEATURE_DISCARD;
+    if (mode3d && shadowed) features |= FEATURE_SHADOWS;
+    if (mode3d && lights > 0) features |= FEATURE_LIGHTS;
+    if (fogged) features |= FEATURE_FOG;
+    return features;
+}
+
+// Point lights are binned against the camera and target the geometry is
+// actually drawn with, so they're brought up to date right before drawing.
+static void bindlights() {
+    int lights = 0;
+    if (mode3d && find_uniform(active_shader(), "lights") >= 0) {
+        Image target = currentfbo();
+        lights = bin_lights(view, projection, near, far, width(target), height(target));
+    }
+    bind_features(select_features(lights));
+    if (mode3d) glUniform1i(find_uniform("lights"), lights);
 }
 
+// Geometry that has to be uploaded anyway is sorted nearest first on the way.
 static void drawbuf(Buffer& buf) {
     if (!buf.empty()) {
+        if (depthsorted && mode3d && buf.dirty) {
+            float modelview[4][4];
+            matset(modelview, transform);
+            matmult(modelview, view);
+            buf.sortdepth(modelview);
+        }
+        bindlights();
         buf.draw();
     }
 }
@@ -156,7 +340,12 @@ static bool stateful(const Step& step) {
         case STEP_SET_ORIGIN:
         case STEP_BEGIN:
         case STEP_FONT:
+        case STEP_INSTANCING:
+        case STEP_EMIT:
             return false;
+        case STEP_SHADOWS:
+        case STEP_DEPTH_SORT:
+            return true;
         case STEP_RECT:
         case STEP_POLYGON:
             return mode3d || texture != findimg(BLANK).id;
@@ -165,6 +354,10 @@ static bool stateful(const Step& step) {
         case STEP_TEXT:
         case STEP_WRAPPED_TEXT:
             return mode3d || findimg(currentfont).id != texture;
+        case STEP_TILEMAP:
+        case STEP_PARTICLES:
+        case STEP_INSTANCES:
+            return true;
         case STEP_BOARD:
             return !mode3d || findimg(step.data.board.img).id != texture;
         case STEP_CUBE:
@@ -216,6 +409,37 @@ static bool stateful(const Step& step) {
     }
 }
 
+// Why a step that ends the current batch does so, given the state before it.
+// Shapes only end a batch when they need another texture, or the other mode.
+static BreakReason breakreason(const Step& step) {
+    switch (step.type) {
+        case STEP_RECT:
+        case STEP_POLYGON:
+        case STEP_SPRITE:
+        case STEP_TEXT:
+        case STEP_WRAPPED_TEXT:
+            return mode3d ? LIBDRAW_CONST(MODE_BREAK) : LIBDRAW_CONST(TEXTURE_BREAK);
+        case STEP_BOARD:
+        case STEP_CUBE:
+        case STEP_SLANT:
+        case STEP_PRISM:
+        case STEP_CONE:
+        case STEP_HEDRON:
+            return !mode3d ? LIBDRAW_CONST(MODE_BREAK) : LIBDRAW_CONST(TEXTURE_BREAK);
+        case STEP_RENDER:
+        case STEP_TILEMAP:
+        case STEP_PARTICLES:
+        case STEP_INSTANCES:
+            return LIBDRAW_CONST(DRAW_BREAK);
+        default:
+            switch (stepkind(step.type)) {
+                case LIBDRAW_CONST(CAMERA_STEPS): return LIBDRAW_CONST(CAMERA_BREAK);
+                case LIBDRAW_CONST(TRANSFORM_STEPS): return LIBDRAW_CONST(TRANSFORM_BREAK);
+                default: return LIBDRAW_CONST(STATE_BREAK);
+            }
+    }
+}
+
 // static void bindtex(Image i) {
 //     if (texture != findimg(i).id) {
 //         glBindTexture(GL_TEXTURE_2D, findimg(i).id);
@@ -227,10 +451,146 @@ static void bindtex(Buffer& buf, Image i) {
     if (texture != findimg(i).id) {
         drawbuf(buf), buf.reset();
         glBindTexture(GL_TEXTURE_2D, findimg(i).id);
+        framecounts.texturebinds ++;
         texture = findimg(i).id;
     }
 }
 
+static void setmodel(float matrix[4][4]) {
+    matset(transform, matrix);
+    glUniformMatrix4fv(find_uniform("model"), 1, GL_FALSE, (const GLfloat*)transform);
+}
+
+// Models marked as occluders are drawn into a small depth buffer on the CPU as
+// they're rendered, and every model rendered after them is tested against it
+// first. The buffer only holds for one camera, so it starts over whenever the
+// camera changes.
+static bool hiztest(Buffer& b) {
+    float vp[4][4], mvp[4][4];
+    matset(vp, view);
+    matmult(vp, projection);
+    if (memcmp(vp, hizcamera, sizeof(vp))) clear_hiz(), matset(hizcamera, vp);
+    matset(mvp, transform);
+    matmult(mvp, vp);
+    if (!hiz_visible(b.lo, b.hi, mvp)) return false;
+    if (b.occluder) rasterize_occluder(b, mvp);
+    return true;
+}
+
+// Looks up last frame's query for this rendering of a model, and queues a new
+// one for this frame. Results that are already in are used on the CPU, so a
+// hidden model costs nothing at all; otherwise the GPU decides, without
+// waiting, whether to draw it. Boxes that reach past the near plane can't be
+// tested, and neither can anything while a shadow map is drawn.
+static Occlusion occlusiontest(Model model) {
+    Occlusion result = { false, 0 };
+    if (shadowpass) return result;
+    Buffer& b = findbuf(model);
+    if (b.dirty) b.bake();
+    if ((b.occluder || !hiz_empty()) && !hiztest(b)) {
+        occluded_count ++;
+        result.hidden = true;
+        return result;
+    }
+    if (!occluding) return result;
+
+    // the box is grown a little, so that a model that's a box itself doesn't
+    // hide its own query box behind faces at exactly the same depth
+    float pad = 0;
+    for (int k = 0; k < 3; k ++) if ((b.hi[k] - b.lo[k]) * PROXY_MARGIN > pad) pad = (b.hi[k] - b.lo[k]) * PROXY_MARGIN;
+    pad += PROXY_MARGIN;
+    float box[4][4] = {
+        { b.hi[0] - b.lo[0] + 2 * pad, 0, 0, 0 },
+        { 0, b.hi[1] - b.lo[1] + 2 * pad, 0, 0 },
+        { 0, 0, b.hi[2] - b.lo[2] + 2 * pad, 0 },
+        { b.lo[0] - pad, b.lo[1] - pad, b.lo[2] - pad, 1 }
+    };
+    matmult(box, transform);
+    float mv[4][4];
+    matset(mv, box);
+    matmult(mv, view);
+    for (int i = 0; i < 8; i ++) {
+        float x = i & 1, y = i >> 1 & 1, z = i >> 2;
+        if (x * mv[0][2] + y * mv[1][2] + z * mv[2][2] + mv[3][2] > -near) return result;
+    }
+
+    while (rendercounts.size() <= (u32)model) rendercounts.push(0);
+    u64 key = (u64)model << 32 | rendercounts[model] ++;
+    OcclusionSlot& slot = occlusionslots[key];
+    bool fresh = !slot.frame;
+    if (fresh) glGenQueries(2, slot.queries);
+    if (!fresh && slot.frame + 1 == occlusionframe) {
+        GLuint last = slot.queries[slot.next ^ 1], ready = 0, passed = 1;
+        glGetQueryObjectuiv(last, GL_QUERY_RESULT_AVAILABLE, &ready);
+        if (ready) glGetQueryObjectuiv(last, GL_QUERY_RESULT, &passed), result.hidden = !passed;
+        else result.condition = last;
+    }
+    if (result.hidden) occluded_count ++;
+
+    Proxy proxy;
+    proxy.query = slot.queries[slot.next];
+    matset(proxy.matrix, box);
+    proxies.push(proxy);
+    slot.next ^= 1, slot.frame = occlusionframe;
+    return result;
+}
+
+static void drawmodel(Buffer& buf, Model model, Image img, const Occlusion& occlusion, bool prepass = false) {
+    if (occlusion.hidden) return;
+    bindtex(buf, img);
+    if (occlusion.condition) glBeginConditionalRender(occlusion.condition, GL_QUERY_NO_WAIT);
+    if (prepass) findbuf(model).draw();
+    else drawbuf(findbuf(model));
+    if (occlusion.condition) glEndConditionalRender();
+}
+
+// Placed instances that survive the frustum are grouped by model and texture.
+// Groups of models made only of triangles are drawn in a single call, with
+// each instance's matrix read per instance; anything else, or anything under
+// a custom vertex stage, is drawn one instance at a time.
+static void drawplaced(Buffer& buf) {
+    static vector<Instance> visible;
+    static vector<float> keys, matrices;
+    static vector<u32> order;
+    float mvp[4][4];
+    matset(mvp, transform);
+    matmult(mvp, view);
+    matmult(mvp, projection);
+    visible_instances(mvp, visible);
+    keys.clear();
+    for (Instance i : visible) keys.push(findinstance(i).batch);
+    sortkeys(keys.begin(), keys.size(), order);
+
+    float saved[4][4];
+    matset(saved, transform);
+    bool together = default_vertex(active_shader());
+    for (u32 n = 0, end = 0; n < order.size(); n = end) {
+        const InstanceMeta& first = findinstance(visible[order[n]]);
+        while (end < order.size() && findinstance(visible[order[end]]).batch == first.batch) end ++;
+        Buffer& b = findbuf(first.model);
+        if (b.dirty) b.bake();
+        bindtex(buf, first.img);
+        if (together && b.cubes.size() == 0 && b.boards.size() == 0) {
+            matrices.clear();
+            for (u32 k = n; k < end; k ++) {
+                const float* m = &findinstance(visible[order[k]]).matrix[0][0];
+                for (int j = 0; j < 16; j ++) matrices.push(m[j]);
+            }
+            bindlights();
+            b.drawplaced(matrices);
+            continue;
+        }
+        for (u32 k = n; k < end; k ++) {
+            float placed[4][4];
+            matset(placed, findinstance(visible[order[k]]).matrix);
+            matmult(placed, saved);
+            setmodel(placed);
+            drawbuf(b);
+        }
+        setmodel(saved);
+    }
+}
+
 static void plane(Buffer& buf, 
     float x, float y, float z, float w, float h,  
     float hx, float hy, float hz, 
@@ -418,6 +778,51 @@ static void cube(Buffer& buf, float x, float y, float z, float w, float h, float
     }
 }
 
+// Instanced counterparts of cube() and plane(). These emit a single record per
+// primitive, and leave tessellation and UV generation to the cube and board
+// variants of the active shader.
+
+static void cubeinstance(Buffer& buf, float x, float y, float z, float w, float h, float l, Texture tex) {
+    float ox = int(orig) % 3 - 1, oy = int(orig) % 9 / 3 - 1, oz = int(orig) / 9 - 1;
+    x -= w * ox / 2; y -= h * oy / 2; z -= l * oz / 2;
+
+    TexProps side, top, bottom;
+    side.use(tex.iside), top.use(tex.itop), bottom.use(tex.ibottom);
+    bool stretch = tex.type == LIBDRAW_CONST(STRETCH_CUBE) 
+        || tex.type == LIBDRAW_CONST(STRETCH_PILLAR) 
+        || tex.type == LIBDRAW_CONST(STRETCH_SIDED);
+
+    float record[CUBE_INSTANCE] = {
+        x, y, z, w, h, l,
+        red, green, blue, alpha,
+        side.u, side.v, side.uw, side.vh,
+        top.u, top.v, top.uw, top.vh,
+        bottom.u, bottom.v, bottom.uw, bottom.vh,
+        side.iw, side.ih, top.iw, top.ih,
+        bottom.iw, bottom.ih, stretch ? 1.0f : 0.0f
+    };
+    buf.instance(buf.cubes, record, CUBE_INSTANCE);
+}
+
+static void boardinstance(Buffer& buf, float x, float y, float z, float w, float h, Image i) {
+    ImageMeta* meta = &findimg(i);
+    while (meta->parent > 0) meta = &findimg(meta->parent);
+
+    float u = float(findimg(i).x) / meta->w, v = float(findimg(i).y) / meta->h;
+    float uw = float(findimg(i).w) / meta->w, vh = float(findimg(i).h) / meta->h;
+
+    if (w < 0) w *= -1, u += uw, uw *= -1;
+    if (h < 0) h *= -1, v += vh, vh *= -1;
+
+    float ox = int(orig) % 3, oy = int(orig) % 9 / 3;
+    float record[BOARD_INSTANCE] = {
+        x, y, z, w, h, 0.5f * ox, 0.5f * oy,
+        red, green, blue, alpha,
+        u, v, uw, vh
+    };
+    buf.instance(buf.boards, record, BOARD_INSTANCE);
+}
+
 static void prism(Buffer& buf, float x, float y, float z, float w, float h, float l, int n, Axis axis, Texture tex) {
     float dx = w / 2, dy = h / 2, dz = l / 2;
     float ox = int(orig) % 3 - 1, oy = int(orig) % 9 / 3 - 1, oz = int(orig) / 9 - 1;
@@ -451,6 +856,7 @@ static void prism(Buffer& buf, float x, float y, float z, float w, float h, floa
     float frontx = x + lv[0], fronty = y + lv[1], frontz = z + lv[2];
     float backx = x - lv[0], backy = y - lv[1], backz = z - lv[2];
 
+    const float* ring = unit_ring(n);
     TexProps tp;
 
     // front
@@ -458,13 +864,12 @@ static void prism(Buffer& buf, float x, float y, float z, float w, float h, floa
     tp.use(tex.itop);
     
     for (int i = 0; i < n; i ++) {
-        float a1 = 2 * pi * i / n - 0.5 * pi, a2 = 2 * pi * (i + 1) / n - 0.5 * pi;
         for (int j = 0; j < 3; j ++) {
             buf.norm(ln[0], ln[1], ln[2]); 
             buf.col(red, green, blue, alpha); 
             buf.spr(tp.u, tp.v, tp.uw * (endw / tp.iw), tp.vh * (endh / tp.ih));
         }
-        float sa1 = sin(a1), ca1 = cos(a1), sa2 = sin(a2), ca2 = cos(a2);
+        float ca1 = ring[i * 2], sa1 = ring[i * 2 + 1], ca2 = ring[i * 2 + 2], sa2 = ring[i * 2 + 3];
         buf.pos(frontx, fronty, frontz);
         buf.pos(frontx + ca1 * hv[0] + sa1 * vv[0], fronty + ca1 * hv[1] + sa1 * vv[1], frontz + ca1 * hv[2] + sa1 * vv[2]);
         buf.pos(frontx + ca2 * hv[0] + sa2 * vv[0], fronty + ca2 * hv[1] + sa2 * vv[1], frontz + ca2 * hv[2] + sa2 * vv[2]);
@@ -478,13 +883,12 @@ static void prism(Buffer& buf, float x, float y, float z, float w, float h, floa
     tp.use(tex.ibottom);
 
     for (int i = 0; i < n; i ++) {
-        float a1 = 2 * pi * i / n - 0.5 * pi, a2 = 2 * pi * (i + 1) / n - 0.5 * pi;
         for (int j = 0; j < 3; j ++) {
             buf.norm(-ln[0], -ln[1], -ln[2]); 
             buf.col(red, green, blue, alpha); 
             buf.spr(tp.u + (2 * sidew / 3 / tp.iw) * tp.uw, tp.v + (endh / tp.ih + sideh / tp.ih) * tp.vh, tp.uw * (endw / tp.iw), tp.vh * (endh / tp.ih));
         }
-        float sa1 = sin(a1), ca1 = cos(a1), sa2 = sin(a2), ca2 = cos(a2);
+        float ca1 = ring[i * 2], sa1 = ring[i * 2 + 1], ca2 = ring[i * 2 + 2], sa2 = ring[i * 2 + 3];
         buf.pos(backx, backy, backz);
         buf.pos(backx + ca2 * hv[0] + sa2 * vv[0], backy + ca2 * hv[1] + sa2 * vv[1], backz + ca2 * hv[2] + sa2 * vv[2]);
         buf.pos(backx + ca1 * hv[0] + sa1 * vv[0], backy + ca1 * hv[1] + sa1 * vv[1], backz + ca1 * hv[2] + sa1 * vv[2]);
@@ -498,8 +902,7 @@ static void prism(Buffer& buf, float x, float y, float z, float w, float h, floa
     tp.use(tex.iside);
 
     for (int i = 0; i < n; i ++) {
-        float a1 = 2 * pi * i / n - 0.5 * pi, a2 = 2 * pi * (i + 1) / n - 0.5 * pi;
-        float sa1 = sin(a1), ca1 = cos(a1), sa2 = sin(a2), ca2 = cos(a2);
+        float ca1 = ring[i * 2], sa1 = ring[i * 2 + 1], ca2 = ring[i * 2 + 2], sa2 = ring[i * 2 + 3];
         for (int j = 0; j < 6; j ++) {
             buf.norm(
                 0.5 * ca1 * hn[0] + ca2 * hn[0] + 0.5 * sa1 * vn[0] + sa2 * vn[0],
@@ -560,19 +963,19 @@ static void pyramid(Buffer& buf, float x, float y, float z, float w, float h, fl
     float frontx = x + lv[0], fronty = y + lv[1], frontz = z + lv[2];
     float backx = x - lv[0], backy = y - lv[1], backz = z - lv[2];
 
+    const float* ring = unit_ring(n);
     TexProps tp;
 
     // front
     bindtex(buf, tex.itop);
     tp.use(tex.itop);
     if (flipped) for (int i = 0; i < n; i ++) {
-        float a1 = 2 * pi * i / n - 0.5 * pi, a2 = 2 * pi * (i + 1) / n - 0.5 * pi;
         for (int j = 0; j < 3; j ++) {
             buf.norm(ln[0], ln[1], ln[2]); 
             buf.col(red, green, blue, alpha); 
             buf.spr(tp.u, tp.v, tp.uw * (endw / tp.iw), tp.vh * (endh / tp.ih));
         }
-        float sa1 = sin(a1), ca1 = cos(a1), sa2 = sin(a2), ca2 = cos(a2);
+        float ca1 = ring[i * 2], sa1 = ring[i * 2 + 1], ca2 = ring[i * 2 + 2], sa2 = ring[i * 2 + 3];
         buf.pos(frontx, fronty, frontz);
         buf.pos(frontx + ca1 * hv[0] + sa1 * vv[0], fronty + ca1 * hv[1] + sa1 * vv[1], frontz + ca1 * hv[2] + sa1 * vv[2]);
         buf.pos(frontx + ca2 * hv[0] + sa2 * vv[0], fronty + ca2 * hv[1] + sa2 * vv[1], frontz + ca2 * hv[2] + sa2 * vv[2]);
@@ -585,13 +988,12 @@ static void pyramid(Buffer& buf, float x, float y, float z, float w, float h, fl
     bindtex(buf, tex.ibottom);
     tp.use(tex.ibottom);
     if (!flipped) for (int i = 0; i < n; i ++) {
-        float a1 = 2 * pi * i / n - 0.5 * pi, a2 = 2 * pi * (i + 1) / n - 0.5 * pi;
         for (int j = 0; j < 3; j ++) {
             buf.norm(-ln[0], -ln[1], -ln[2]); 
             buf.col(red, green, blue, alpha); 
             buf.spr(tp.u, tp.v, tp.uw * (endw / tp.iw), tp.vh * (endh / tp.ih));
         }
-        float sa1 = sin(a1), ca1 = cos(a1), sa2 = sin(a2), ca2 = cos(a2);
+        float ca1 = ring[i * 2], sa1 = ring[i * 2 + 1], ca2 = ring[i * 2 + 2], sa2 = ring[i * 2 + 3];
         buf.pos(backx, backy, backz);
         buf.pos(backx + ca2 * hv[0] + sa2 * vv[0], backy + ca2 * hv[1] + sa2 * vv[1], backz + ca2 * hv[2] + sa2 * vv[2]);
         buf.pos(backx + ca1 * hv[0] + sa1 * vv[0], backy + ca1 * hv[1] + sa1 * vv[1], backz + ca1 * hv[2] + sa1 * vv[2]);
@@ -605,7 +1007,7 @@ static void pyramid(Buffer& buf, float x, float y, float z, float w, float h, fl
     tp.use(tex.iside);
     for (int i = 0; i < n; i ++) {
         float a1 = 2 * pi * i / n - 0.5 * pi, a2 = 2 * pi * (i + 1) / n - 0.5 * pi;
-        float sa1 = sin(a1), ca1 = cos(a1), sa2 = sin(a2), ca2 = cos(a2);
+        float ca1 = ring[i * 2], sa1 = ring[i * 2 + 1], ca2 = ring[i * 2 + 2], sa2 = ring[i * 2 + 3];
         float rx1 = ca1 * hv[0] + sa1 * vv[0], ry1 = ca1 * hv[1] + sa1 * vv[1], rz1 = ca1 * hv[2] + sa1 * vv[2];
         float rx2 = ca2 * hv[0] + sa2 * vv[0], ry2 = ca2 * hv[1] + sa2 * vv[1], rz2 = ca2 * hv[2] + sa2 * vv[2];
         float rx = (rx1 + rx2) / 2, ry = (ry1 + ry2) / 2, rz = (rz1 + rz2) / 2;
@@ -638,63 +1040,119 @@ static void pyramid(Buffer& buf, float x, float y, float z, float w, float h, fl
     }
 }
 
+// Radius in pixels of a sphere around (x, y, z) under the current transform
+// and camera. A sphere the camera is inside of gets as many as it likes.
+static float pixelradius(float x, float y, float z, float r) {
+    float mvp[4][4];
+    matset(mvp, transform);
+    matmult(mvp, view);
+    matmult(mvp, projection);
+    float s = 0;
+    for (int i = 0; i < 3; i ++) s = fmax(s, sqrt(transform[i][0] * transform[i][0] + transform[i][1] * transform[i][1] + transform[i][2] * transform[i][2]));
+    float w = x * mvp[0][3] + y * mvp[1][3] + z * mvp[2][3] + mvp[3][3];
+    bool perspective = projection[2][3] != 0;
+    if (perspective && w <= r * s) return 1e9f;
+    return r * s * fabs(projection[1][1]) * height(currentfbo()) / 2 / w;
+}
+
+// Screen area, in pixels, that one triangle of a model should cover before a
+// simpler level of it is drawn instead.
+static const float PIXELS_PER_TRIANGLE = 8;
+
+// The level of detail of a model to draw at its current size on screen: the
+// most detailed one whose triangles each still cover a few pixels.
+static Model chooselod(Model model) {
+    Buffer& b = findbuf(model);
+    if (!b.lods.size()) return model;
+    if (b.dirty) b.bake();
+    float dx = b.hi[0] - b.lo[0], dy = b.hi[1] - b.lo[1], dz = b.hi[2] - b.lo[2];
+    float r = pixelradius(b.center[0], b.center[1], b.center[2], sqrt(dx * dx + dy * dy + dz * dz) / 2);
+    float budget = pi * r * r / PIXELS_PER_TRIANGLE;
+    Model chosen = model;
+    for (u32 i = 0; i < b.lods.size() && findbuf(chosen).verts.size() / 9 > budget; i ++) chosen = b.lods[i];
+    return chosen;
+}
+
+// The impostor view of a model to draw in its place, or -1 if the model is
+// near enough to be drawn as it is. Views are picked by the direction of the
+// camera around the model, in the model's own space, so turned models show
+// the side facing the camera.
+static Model chooseimpostor(Model model) {
+    Buffer& b = findbuf(model);
+    if (!b.impostors.size()) return -1;
+    if (b.dirty) b.bake();
+    float mv[4][4];
+    matset(mv, transform);
+    matmult(mv, view);
+    float c[3];
+    for (int k = 0; k < 3; k ++) c[k] = b.center[0] * mv[0][k] + b.center[1] * mv[1][k] + b.center[2] * mv[2][k] + mv[3][k];
+    if (c[0] * c[0] + c[1] * c[1] + c[2] * c[2] < b.impostordistance * b.impostordistance) return -1;
+
+    // the camera sits at the view space origin, so it's -c away from the
+    // center; taking that back through the model's rotation and scale only
+    // needs the direction, so the adjugate stands in for the inverse
+    float x = 0, z = 0;
+    for (int k = 0; k < 3; k ++) {
+        int k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+        x -= c[k] * (mv[1][k1] * mv[2][k2] - mv[1][k2] * mv[2][k1]);
+        z -= c[k] * (mv[0][k1] * mv[1][k2] - mv[0][k2] * mv[1][k1]);
+    }
+    float det = mv[0][0] * (mv[1][1] * mv[2][2] - mv[1][2] * mv[2][1])
+        - mv[0][1] * (mv[1][0] * mv[2][2] - mv[1][2] * mv[2][0])
+        + mv[0][2] * (mv[1][0] * mv[2][1] - mv[1][1] * mv[2][0]);
+    if (det < 0) x = -x, z = -z;
+    int views = b.impostors.size();
+    int i = (int)round(atan2(x, z) * 180 / pi / (360.0f / views));
+    return b.impostors[(i % views + views) % views];
+}
+
+// What to draw for a model rendered with an image: an impostor from afar,
+// or the level of detail that suits its size on screen. Shadow maps always
+// get the full model.
+static void choosedetail(Model& model, Image& img) {
+    if (shadowpass) return;
+    Model impostor = chooseimpostor(model);
+    if (impostor >= 0) {
+        img = findbuf(model).impostorimg;
+        model = impostor;
+        return;
+    }
+    model = chooselod(model);
+}
+
+// Side count for a round shape given zero or fewer sides. Without automatic
+// detail, that's the count sphere(), cylinder() and cone() always had.
+static int autosides(float x, float y, float z, float w, float h, float l, int fallback) {
+    if (!autodetail) return fallback;
+    float ox = int(orig) % 3 - 1, oy = int(orig) % 9 / 3 - 1, oz = int(orig) / 9 - 1;
+    x -= w * ox / 2; y -= h * oy / 2; z -= l * oz / 2;
+    float r = fmax(fabs(w), fmax(fabs(h), fabs(l))) / 2;
+    while (lodlevels.size() <= lodcount) lodlevels.push(-1);
+    return lod_sides(pixelradius(x, y, z, r), lodlevels[lodcount ++]);
+}
+
 static void hedron(Buffer& buf, float x, float y, float z, float w, float h, float l, int m, int n, Texture tex) {
     float dx = w / 2, dy = h / 2, dz = l / 2;
     float ox = int(orig) % 3 - 1, oy = int(orig) % 9 / 3 - 1, oz = int(orig) / 9 - 1;
     x -= w * ox / 2; y -= h * oy / 2; z -= l * oz / 2;
-    
-    float* mercator = new float[n + 1];
-    for (int i = 1; i < n; i ++) {
-        float phi = (float(i) / n - 0.5f) * pi;
-        mercator[i] = fmin(10.0f, log(abs(1 / cos(phi) + tan(phi))));
-    }
-    mercator[0] = -10.0f;
-    mercator[n] = 10.0f;  
-    for (int i = 0; i <= n; i ++) mercator[i] += 10.0f; 
-    float msum = 0;
-    for (int i = 0; i <= n; i ++) {
-        msum += mercator[i];
-        if (i > 1) mercator[i] += mercator[i - 1];
-    }
-    for (int i = 0; i <= n; i ++) mercator[i] /= msum;
 
     TexProps tp;
     bindtex(buf, tex.iside);
     tp.use(tex.iside);
 
-    for (int i = 0; i < m; i ++) {
-        for (int j = 0; j < n; j ++) {
-            float y1 = 2 * pi * i / m - 0.5 * pi, y2 = 2 * pi * (i + 1) / m - 0.5 * pi;
-            float p1 = pi * j / n - 0.5 * pi, p2 = pi * (j + 1) / n - 0.5 * pi;
-            float sy1 = sin(y1), cy1 = cos(y1), sy2 = sin(y2), cy2 = cos(y2);
-            float sp1 = sin(p1), cp1 = cos(p1), sp2 = sin(p2), cp2 = cos(p2);
-            float nx = (cp1 * sy1 + cp1 * sy2 + cp2 * sy2 + cp2 * sy1) / 4,
-                  ny = (sp1 + sp2) / 2,
-                  nz = (cp1 * cy1 + cp1 * cy2 + cp2 * cy2 + cp2 * cy1) / 4;
-            for (int k = 0; k < 6; k ++) {
-                buf.norm(nx, ny, nz); 
-                buf.col(red, green, blue, alpha); 
-                buf.spr(tp.u, tp.v, tp.uw, tp.vh);
-            }
-            buf.pos(x + dx * cp1 * sy1, y + dy * sp1, z + dz * cp1 * cy1);
-            buf.pos(x + dx * cp1 * sy2, y + dy * sp1, z + dz * cp1 * cy2);
-            buf.pos(x + dx * cp2 * sy2, y + dy * sp2, z + dz * cp2 * cy2);
-            buf.pos(x + dx * cp2 * sy2, y + dy * sp2, z + dz * cp2 * cy2);
-            buf.pos(x + dx * cp2 * sy1, y + dy * sp2, z + dz * cp2 * cy1);
-            buf.pos(x + dx * cp1 * sy1, y + dy * sp1, z + dz * cp1 * cy1);
-            
-            // mercator scaling
-
-            buf.uv(float(i) / m, mercator[j]);
-            buf.uv(float(i + 1) / m, mercator[j]);
-            buf.uv(float(i + 1) / m, mercator[j + 1]);
-            buf.uv(float(i + 1) / m, mercator[j + 1]);
-            buf.uv(float(i) / m, mercator[j + 1]);
-            buf.uv(float(i) / m, mercator[j]);
+    const UnitSphere& sphere = unit_sphere(m, n);
+    for (int q = 0; q < m * n; q ++) {
+        const float* norm = &sphere.norms[q * 3];
+        const float* pos = &sphere.pos[q * 18];
+        const float* uv = &sphere.uvs[q * 12];
+        for (int k = 0; k < 6; k ++) {
+            buf.norm(norm[0], norm[1], norm[2]); 
+            buf.col(red, green, blue, alpha); 
+            buf.spr(tp.u, tp.v, tp.uw, tp.vh);
         }
+        for (int k = 0; k < 6; k ++) buf.pos(x + dx * pos[k * 3], y + dy * pos[k * 3 + 1], z + dz * pos[k * 3 + 2]);
+        for (int k = 0; k < 6; k ++) buf.uv(uv[k * 2], uv[k * 2 + 1]);
     }
-
-    delete[] mercator;
 }
 
 static void text(Buffer& buf, float x, float y, const char* str, float width) {
@@ -758,6 +1216,43 @@ static void text(Buffer& buf, float x, float y, const char* str, float width) {
     }
 }
 
+static void tilemap(Buffer& buf, Tilemap map, float x, float y) {
+    TilemapMeta& tm = findmap(map);
+    bindtex(buf, tm.sheet);
+    ImageMeta* meta = &findimg(tm.sheet);
+    while (meta->parent > 0) meta = &findimg(meta->parent);
+    ImageMeta& sheet = findimg(tm.sheet);
+
+    float w = tm.cols * tm.tilew, h = tm.rows * tm.tileh;
+    float ox = int(orig) % 3, oy = int(orig) % 9 / 3;
+    x -= 0.5f * ox * w, y -= 0.5f * oy * h;
+
+    buf.pos(x + w, y, 0);
+    buf.pos(x, y, 0);
+    buf.pos(x, y + h, 0);
+    buf.pos(x, y + h, 0);
+    buf.pos(x + w, y + h, 0);
+    buf.pos(x + w, y, 0);
+    for (int i = 0; i < 6; i ++) buf.col(red, green, blue, alpha);
+    for (int i = 0; i < 6; i ++) buf.norm(0, 0, -1);
+    buf.uv(tm.cols, 0); buf.uv(0, 0); buf.uv(0, tm.rows);
+    buf.uv(0, tm.rows); buf.uv(tm.cols, tm.rows); buf.uv(tm.cols, 0);
+    for (int i = 0; i < 6; i ++) 
+        buf.spr(float(sheet.x) / meta->w, float(sheet.y) / meta->h, float(sheet.w) / meta->w, float(sheet.h) / meta->h);
+
+    Shader s = active_shader();
+    bind(tilemap_shader());
+    glActiveTexture(GL_TEXTURE0 + TILEMAP_UNIT);
+    glBindTexture(GL_TEXTURE_2D, tm.tex);
+    framecounts.texturebinds ++;
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(find_uniform("tiles"), TILEMAP_UNIT);
+    glUniform2i(find_uniform("sheet_tiles"), sheet.w / tm.tilew, sheet.h / tm.tileh);
+    glUniform2i(find_uniform("map_size"), tm.cols, tm.rows);
+    drawbuf(buf), buf.reset();
+    bind(s);
+}
+
 static void normalize(float& x, float& y, float& z) {
     float len = sqrt(x * x + y * y + z * z);
     x /= len, y /= len, z /= len;
@@ -1495,6 +1990,8 @@ void ensure2d() {
     if (mode3d) {
         mode3d = false;
         glUniform3f(find_uniform("light"), 0, 0, 1);
+        glUniform1i(find_uniform("shadows"), 0);
+        glUniform1i(find_uniform("lights"), 0);
         glDepthMask(GL_FALSE);
         glCullFace(GL_FRONT);
     }
@@ -1504,22 +2001,32 @@ void ensure3d() {
     if (!mode3d) {
         mode3d = true;
         glUniform3f(find_uniform("light"), lightx, lighty, lightz);
+        glUniform1i(find_uniform("shadows"), shadowed);
+        glUniform1i(find_uniform("lights"), binned_lights());
         glDepthMask(GL_TRUE);
         glCullFace(GL_BACK);
     }
 }
 
+// Boards drawn on the CPU path face the camera using the right and down axes
+// of the current view.
 static void recalc_boards() {
-    boardh[0] = sin((90 - yaw) * pi / 180);
-    boardh[1] = 0;
-    boardh[2] = cos((90 - yaw) * pi / 180);
-
-    boardv[0] = sin(-yaw * pi / 180) * cos((-90 - pitch) * pi / 180);
-    boardv[1] = sin((-90 - pitch) * pi / 180);
-    boardv[2] = cos(-yaw * pi / 180) * cos((-90 - pitch) * pi / 180);
+    float hl = sqrt(view[0][0] * view[0][0] + view[1][0] * view[1][0] + view[2][0] * view[2][0]);
+    float vl = sqrt(view[0][1] * view[0][1] + view[1][1] * view[1][1] + view[2][1] * view[2][1]);
+    if (hl == 0 || vl == 0) return;
+    for (int i = 0; i < 3; i ++) {
+        boardh[i] = view[i][0] / hl;
+        boardv[i] = -view[i][1] / vl;
+    }
 }
 
 static void step(Buffer& buf, const Step& step) {
+    // a shadow map is drawn from the light, so camera steps are held back and
+    // applied to the camera once the map is done
+    if (shadowpass && stepkind(step.type) == LIBDRAW_CONST(CAMERA_STEPS)) {
+        shadowcamera.push(step);
+        return;
+    }
     switch (step.type) {
         case STEP_SET_COLOR: {
             Color c = step.data.set_color.color;
@@ -1571,16 +2078,26 @@ static void step(Buffer& buf, const Step& step) {
             delete[] t.str;
             return;
         }
+        case STEP_TILEMAP: {
+            ensure2d();
+            auto& t = step.data.tilemap;
+            return tilemap(buf, t.map, t.x, t.y);
+        }
         case STEP_CUBE: {
             ensure3d();
             auto& c = step.data.cube;
             bindtex(buf, c.tex.iside);
+            if (instanced && default_vertex(active_shader())
+                && findimg(c.tex.itop).id == texture && findimg(c.tex.ibottom).id == texture)
+                return cubeinstance(buf, c.x, c.y, c.z, c.w, c.h, c.l, c.tex);
             return cube(buf, c.x, c.y, c.z, c.w, c.h, c.l, c.tex);
         }
         case STEP_BOARD: {
             ensure3d();
             auto& b = step.data.board;
             bindtex(buf, b.img);
+            if (default_vertex(active_shader()))
+                return boardinstance(buf, b.x, b.y, b.z, b.w, b.h, b.img);
             return plane(buf, b.x, b.y, b.z, b.w, b.h, boardh[0], boardh[1], boardh[2], boardv[0], boardv[1], boardv[2], b.img);
         }
         case STEP_SLANT: {
@@ -1593,19 +2110,23 @@ static void step(Buffer& buf, const Step& step) {
             ensure3d();
             auto& p = step.data.prism;
             bindtex(buf, p.tex.iside);
-            return prism(buf, p.x, p.y, p.z, p.w, p.h, p.l, p.n, p.axis, p.tex);
+            int n = p.n > 0 ? p.n : autosides(p.x, p.y, p.z, p.w, p.h, p.l, 32);
+            return prism(buf, p.x, p.y, p.z, p.w, p.h, p.l, n, p.axis, p.tex);
         }
         case STEP_CONE: {
             ensure3d();
             auto& c = step.data.cone;
             bindtex(buf, c.tex.iside);
-            return pyramid(buf, c.x, c.y, c.z, c.w, c.h, c.l, c.n, c.dir, c.tex);
+            int n = c.n > 0 ? c.n : autosides(c.x, c.y, c.z, c.w, c.h, c.l, 32);
+            return pyramid(buf, c.x, c.y, c.z, c.w, c.h, c.l, n, c.dir, c.tex);
         }
         case STEP_HEDRON: {
             ensure3d();
             auto& h = step.data.hedron;
             bindtex(buf, h.tex.iside);
-            return hedron(buf, h.x, h.y, h.z, h.w, h.h, h.l, h.m, h.n, h.tex);
+            int m = h.m, n = h.n;
+            if (m <= 0 || n <= 0) m = autosides(h.x, h.y, h.z, h.w, h.h, h.l, 16), n = m / 2;
+            return hedron(buf, h.x, h.y, h.z, h.w, h.h, h.l, m, n, h.tex);
         }
         case STEP_ORTHO: {
             identity(projection);
@@ -1642,6 +2163,7 @@ static void step(Buffer& buf, const Step& step) {
                     rotatez(view, step.data.tilt.degrees);
                     break;
             }
+            recalc_boards();
             glUniformMatrix4fv(find_uniform("view"), 1, GL_FALSE, (const GLfloat*)view);
             return;
         }
@@ -1649,10 +2171,10 @@ static void step(Buffer& buf, const Step& step) {
             identity(view);
             camerax = step.data.look.x, cameray = step.data.look.y, cameraz = step.data.look.z;
             yaw = step.data.look.yaw, pitch = step.data.look.pitch;
-            recalc_boards();
             translate(view, -step.data.look.x, -step.data.look.y, -step.data.look.z);
             rotatey(view, yaw);
             rotatex(view, pitch);
+            recalc_boards();
             glUniformMatrix4fv(find_uniform("view"), 1, GL_FALSE, (const GLfloat*)view);
             return;
         }
@@ -1683,8 +2205,11 @@ static void step(Buffer& buf, const Step& step) {
         }
         case STEP_RENDER: {
             ensure3d();
-            bindtex(buf, step.data.render.img);
-            drawbuf(findbuf(step.data.render.model));
+            Model model = step.data.render.model;
+            Image img = step.data.render.img;
+            Occlusion occlusion = occlusiontest(model);
+            choosedetail(model, img);
+            drawmodel(buf, model, img, occlusion);
             return;
         }
         case STEP_BEGIN: {
@@ -1706,8 +2231,9 @@ static void step(Buffer& buf, const Step& step) {
             float green = (c >> 16 & 255) / 255.0f;
             float blue = (c >> 8 & 255) / 255.0f;
             float alpha = (c & 255) / 255.0f;
-            glUniform4f(find_uniform("fog_color"), red, green, blue, alpha);
-            glUniform1f(find_uniform("fog_range"), step.data.fog.range);
+            set_uniformv4(active_shader(), "fog_color", red, green, blue, alpha);
+            set_uniformf(active_shader(), "fog_range", step.data.fog.range);
+            fogged = step.data.fog.range > 0.01f;
             return;
         }
         case STEP_OPACITY: {
@@ -1719,47 +2245,36 @@ static void step(Buffer& buf, const Step& step) {
             return;
         }
         case STEP_UNIFORMI: {
-            Shader sh = active_shader();
-            if (sh != step.data.uniformi.shader) glUseProgram(find_shader(step.data.uniformi.shader));
-            glUniform1i(find_uniform(step.data.uniformi.shader, step.data.uniformi.name), step.data.uniformi.i);
-            delete[] step.data.uniformi.name;
-            if (sh != step.data.uniformi.shader) glUseProgram(find_shader(sh));
+            auto& u = step.data.uniformi;
+            set_uniformi(u.shader, u.name, u.i);
+            delete[] u.name;
             return;
         }
         case STEP_UNIFORMF: {
-            Shader sh = active_shader();
-            if (sh != step.data.uniformf.shader) glUseProgram(find_shader(step.data.uniformf.shader));
-            glUniform1f(find_uniform(step.data.uniformf.shader, step.data.uniformf.name), step.data.uniformf.f);
-            delete[] step.data.uniformf.name;
-            if (sh != step.data.uniformf.shader) glUseProgram(find_shader(sh));
+            auto& u = step.data.uniformf;
+            set_uniformf(u.shader, u.name, u.f);
+            delete[] u.name;
             return;
         }
         case STEP_UNIFORMV2: {
-            Shader sh = active_shader();
-            if (sh != step.data.uniformv2.shader) glUseProgram(find_shader(step.data.uniformv2.shader));
-            glUniform2f(find_uniform(step.data.uniformv2.shader, step.data.uniformv2.name), step.data.uniformv2.x, step.data.uniformv2.y);
-            delete[] step.data.uniformv2.name;
-            if (sh != step.data.uniformv2.shader) glUseProgram(find_shader(sh));
+            auto& u = step.data.uniformv2;
+            set_uniformv2(u.shader, u.name, u.x, u.y);
+            delete[] u.name;
             return;
         }
         case STEP_UNIFORMV3: {
-            Shader sh = active_shader();
-            if (sh != step.data.uniformv3.shader) glUseProgram(find_shader(step.data.uniformv3.shader));
-            glUniform3f(find_uniform(step.data.uniformv3.shader, step.data.uniformv3.name), step.data.uniformv3.x, step.data.uniformv3.y, step.data.uniformv3.z);
-            delete[] step.data.uniformv3.name;
-            if (sh != step.data.uniformv3.shader) glUseProgram(find_shader(sh));
+            auto& u = step.data.uniformv3;
+            set_uniformv3(u.shader, u.name, u.x, u.y, u.z);
+            delete[] u.name;
             return;
         }
         case STEP_UNIFORMV4: {
-            Shader sh = active_shader();
-            if (sh != step.data.uniformv4.shader) glUseProgram(find_shader(step.data.uniformv4.shader));
-            glUniform4f(find_uniform(step.data.uniformv4.shader, step.data.uniformv4.name), step.data.uniformv4.x, step.data.uniformv4.y, step.data.uniformv4.z, step.data.uniformv4.w);
-            delete[] step.data.uniformv4.name;
-            if (sh != step.data.uniformv4.shader) glUseProgram(find_shader(sh));
+            auto& u = step.data.uniformv4;
+            set_uniformv4(u.shader, u.name, u.x, u.y, u.z, u.w);
+            delete[] u.name;
             return;
         }
         case STEP_UNIFORMTEX: {
-            Shader sh = active_shader();
             GLuint texid = GL_TEXTURE0 + step.data.uniformtex.id;
             if (texid == GL_TEXTURE0) {
                 fprintf(stderr, "Could not bind uniform %s: Libdraw forbids use of id 0 in texture uniforms.\n", step.data.uniformtex.name);
@@ -1769,14 +2284,47 @@ static void step(Buffer& buf, const Step& step) {
                 fprintf(stderr, "Texture uniform %s with id %d exceeds maximum texture id %d.\n", step.data.uniformtex.name, step.data.uniformtex.id, 31);
                 exit(1);
             }
-            if (sh != step.data.uniformtex.shader) glUseProgram(find_shader(step.data.uniformtex.shader));
-            glEnable(texid);
             glActiveTexture(texid);
             glBindTexture(GL_TEXTURE_2D, findimg(step.data.uniformtex.i).id);
+            framecounts.texturebinds ++;
             glActiveTexture(GL_TEXTURE0);
-            glUniform1i(find_uniform(step.data.uniformtex.shader, step.data.uniformtex.name), step.data.uniformtex.id);
+            set_uniformi(step.data.uniformtex.shader, step.data.uniformtex.name, step.data.uniformtex.id);
             delete[] step.data.uniformtex.name;
-            if (sh != step.data.uniformtex.shader) glUseProgram(find_shader(sh));
+            return;
+        }
+        case STEP_INSTANCING: {
+            instanced = step.data.instancing.enabled;
+            return;
+        }
+        case STEP_TRANSLUCENT: {
+            translucency = step.data.translucent.enabled;
+            return;
+        }
+        case STEP_OCCLUSION: {
+            occluding = step.data.occlusion.enabled;
+            return;
+        }
+        case STEP_AUTO_LOD: {
+            autodetail = step.data.auto_lod.enabled;
+            return;
+        }
+        case STEP_INSTANCES: {
+            ensure3d();
+            return drawplaced(buf);
+        }
+        case STEP_EMIT: {
+            auto& e = step.data.emit;
+            SpawnBatch batch = { 0, e.count, e.x, e.y, e.z, e.vx, e.vy, e.vz, e.spread, e.life, red, green, blue, alpha };
+            spawn(e.emitter, batch);
+            return;
+        }
+        case STEP_PARTICLES: {
+            ensure3d();
+            Emitter e = step.data.particles.emitter;
+            update_emitter(e);
+            bindtex(buf, findemitter(e).img);
+            bind_features(select_features(mode3d ? binned_lights() : 0));
+            draw_emitter(e);
             return;
         }
         case STEP_SET_LIGHT: {
@@ -1786,22 +2334,422 @@ static void step(Buffer& buf, const Step& step) {
             if (mode3d) glUniform3f(find_uniform("light"), lightx, lighty, lightz);
             return;
         }
+        case STEP_SHADOWS: {
+            shadowed = step.data.shadows.enabled && hasshadows;
+            if (mode3d) glUniform1i(find_uniform("shadows"), shadowed);
+            return;
+        }
+        case STEP_DEPTH_SORT: {
+            depthsorted = step.data.depth_sort.enabled;
+            prepassed = step.data.depth_sort.prepass;
+            return;
+        }
+    }
+}
+
+static int culled_count = 0, culled_last = 0;
+
+// Returns true if the rectangle (x, y, w, h) on the z = 0 plane can't touch the
+// view. Each corner is pushed through the model, view and projection matrices,
+// and the rectangle is only rejected if every corner lies outside the same clip
+// plane, so rotated or scaled transforms are culled conservatively.
+static bool offscreen(float x, float y, float w, float h) {
+    float mvp[4][4];
+    matset(mvp, transform);
+    matmult(mvp, view);
+    matmult(mvp, projection);
+
+    float corners[4][2] = { { x, y }, { x + w, y }, { x, y + h }, { x + w, y + h } };
+    int left = 0, right = 0, bottom = 0, top = 0;
+    for (int i = 0; i < 4; i ++) {
+        float cx = corners[i][0] * mvp[0][0] + corners[i][1] * mvp[1][0] + mvp[3][0];
+        float cy = corners[i][0] * mvp[0][1] + corners[i][1] * mvp[1][1] + mvp[3][1];
+        float cw = corners[i][0] * mvp[0][3] + corners[i][1] * mvp[1][3] + mvp[3][3];
+        if (cx < -cw) left ++;
+        if (cx > cw) right ++;
+        if (cy < -cw) bottom ++;
+        if (cy > cw) top ++;
+    }
+    return left == 4 || right == 4 || bottom == 4 || top == 4;
+}
+
+static bool offscreen_text(float x, float y, const char* str, float width) {
+    int cw = ::width(currentfont) / 32, ch = ::height(currentfont) / 32;
+    int cols = 0, maxcols = 0, rows = 1, words = 1;
+    for (const char* reader = str; *reader; ++ reader) {
+        if (*reader == '\n') rows ++, cols = 0;
+        else if (*reader == '\t') cols += 4 - cols % 4;
+        else cols ++;
+        if (*reader == ' ' || *reader == '\t') words ++;
+        if (cols > maxcols) maxcols = cols;
+    }
+    if (width >= 0) rows += words; // each wrap happens at the start of a word
+    return offscreen(x - cw / 2, y - ch / 2, maxcols * cw + cw, (rows - 1) * ch * 5 / 4 + ch * 2);
+}
+
+// Bounds test for 2D steps, done before any tessellation. Only applied while
+// the active shader uses the default vertex stage, since a custom vertex
+// shader is free to move geometry anywhere.
+static bool cull2d(const Step& step) {
+    if (!default_vertex(active_shader())) return false;
+    switch (step.type) {
+        case STEP_RECT: {
+            auto& r = step.data.rect;
+            return offscreen(r.x, r.y, r.w, r.h);
+        }
+        case STEP_POLYGON: {
+            auto& p = step.data.polygon;
+            float ox = int(orig) % 3 - 1, oy = int(orig) % 9 / 3 - 1;
+            return offscreen(p.x - ox * p.r - p.r, p.y - oy * p.r - p.r, 2 * p.r, 2 * p.r);
+        }
+        case STEP_SPRITE: {
+            auto& s = step.data.sprite;
+            float w = fabs(s.w), h = fabs(s.h);
+            float ox = int(orig) % 3, oy = int(orig) % 9 / 3;
+            return offscreen(s.x - 0.5f * ox * w, s.y - 0.5f * oy * h, w, h);
+        }
+        case STEP_TILEMAP: {
+            auto& t = step.data.tilemap;
+            TilemapMeta& tm = findmap(t.map);
+            float w = tm.cols * tm.tilew, h = tm.rows * tm.tileh;
+            float ox = int(orig) % 3, oy = int(orig) % 9 / 3;
+            return offscreen(t.x - 0.5f * ox * w, t.y - 0.5f * oy * h, w, h);
+        }
+        case STEP_TEXT: {
+            auto& t = step.data.text;
+            if (!offscreen_text(t.x, t.y, t.str, -1)) return false;
+            delete[] t.str;
+            return true;
+        }
+        case STEP_WRAPPED_TEXT: {
+            auto& t = step.data.wraptext;
+            if (!offscreen_text(t.x, t.y, t.str, t.width)) return false;
+            delete[] t.str;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static void beginsamples() {
+    if (!sampling || counting) return;
+    GLuint query;
+    if (freequeries.size()) query = freequeries.back(), freequeries.pop();
+    else glGenQueries(1, &query);
+    glBeginQuery(GL_SAMPLES_PASSED, query);
+    samplequeries[sampleslot].push(query);
+    counting = true;
+}
+
+static void endsamples() {
+    if (!counting) return;
+    glEndQuery(GL_SAMPLES_PASSED);
+    counting = false;
+}
+
+// Held back models are drawn nearest first, by the center of their bounds.
+// With a prepass, their depth is laid down first with color writes off, so
+// the full shader only runs once per pixel. The prepass uses the default
+// vertex stage, so it's skipped under shaders with a custom one.
+static void drawdeferred(Buffer& buf) {
+    if (deferred.size() == 0) return;
+    static vector<float> keys;
+    static vector<u32> order;
+    keys.clear();
+    for (Deferred& d : deferred) {
+        Buffer& b = findbuf(d.model);
+        if (b.dirty) b.bake();
+        float mv[4][4];
+        matset(mv, d.transform);
+        matmult(mv, view);
+        keys.push(-(b.center[0] * mv[0][2] + b.center[1] * mv[1][2] + b.center[2] * mv[2][2] + mv[3][2]));
+    }
+    sortkeys(keys.begin(), keys.size(), order);
+
+    float saved[4][4];
+    matset(saved, transform);
+    bool prepass = prepassed && default_vertex(active_shader());
+    if (prepass) {
+        endsamples();
+        Shader s = active_shader();
+        bind(shadowshader);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for (u32 i : order) {
+            setmodel(deferred[i].transform);
+            drawmodel(buf, deferred[i].model, deferred[i].img, deferred[i].occlusion, true);
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        bind(s);
+        glDepthFunc(GL_LEQUAL);
+        beginsamples();
+    }
+    for (u32 i : order) {
+        setmodel(deferred[i].transform);
+        drawmodel(buf, deferred[i].model, deferred[i].img, deferred[i].occlusion);
+    }
+    if (prepass) glDepthFunc(GL_LESS);
+    setmodel(saved);
+    deferred.clear();
+}
+
+static bool primitive3d(const Step& step) {
+    switch (step.type) {
+        case STEP_CUBE:
+        case STEP_SLANT:
+        case STEP_PRISM:
+        case STEP_CONE:
+        case STEP_HEDRON:
+        case STEP_BOARD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// View space z of the middle of a primitive. The shapes with a length all
+// start with the same fields as a cube, and are placed by the origin the same
+// way. Boards are close enough to their position.
+static float primitivedepth(Translucent& t) {
+    float mv[4][4];
+    matset(mv, t.transform);
+    matmult(mv, view);
+    const auto& c = t.step.data.cube;
+    float x = c.x, y = c.y, z = c.z;
+    if (t.step.type != STEP_BOARD) {
+        float ox = int(t.orig) % 3 - 1, oy = int(t.orig) % 9 / 3 - 1, oz = int(t.orig) / 9 - 1;
+        x -= c.w * ox / 2, y -= c.h * oy / 2, z -= c.l * oz / 2;
+    }
+    return x * mv[0][2] + y * mv[1][2] + z * mv[2][2] + mv[3][2];
+}
+
+// Translucent primitives are drawn farthest first, without writing depth, so
+// each one blends over everything behind it. Neighbours that share a texture
+// and transform end up in the same batch. Boards are instanced and drawn after
+// the rest of a batch, so switching between boards and other shapes starts a
+// new one, and cubes aren't instanced here for the same reason.
+static void drawtranslucent(Buffer& buf) {
+    if (translucents.size() == 0) return;
+    static vector<float> keys;
+    static vector<u32> order;
+    keys.clear();
+    for (Translucent& t : translucents) keys.push(primitivedepth(t));
+    sortkeys(keys.begin(), keys.size(), order);
+
+    float saved[4][4], color[4] = { red, green, blue, alpha };
+    matset(saved, transform);
+    Origin o = orig;
+    bool inst = instanced, sorted = depthsorted;
+    instanced = depthsorted = false;
+    ensure3d();
+    glDepthMask(GL_FALSE);
+    bool boards = false;
+    for (u32 n = 0; n < order.size(); n ++) {
+        Translucent& t = translucents[order[n]];
+        bool board = t.step.type == STEP_BOARD;
+        bool moved = memcmp(t.transform, transform, sizeof(transform));
+        if (moved || (n > 0 && board != boards)) drawbuf(buf), buf.reset();
+        if (moved) setmodel(t.transform);
+        red = t.color[0], green = t.color[1], blue = t.color[2], alpha = t.color[3];
+        orig = t.orig, boards = board;
+        ::step(buf, t.step);
+    }
+    drawbuf(buf), buf.reset();
+    glDepthMask(GL_TRUE);
+
+    red = color[0], green = color[1], blue = color[2], alpha = color[3];
+    orig = o, instanced = inst, depthsorted = sorted;
+    setmodel(saved);
+    translucents.clear();
+}
+
+// Query boxes are drawn against the depth of everything opaque drawn so far,
+// with nothing written and nothing culled, in case the camera is looking at
+// a box from the inside.
+static void drawproxies(Buffer& buf) {
+    if (proxies.size() == 0) return;
+    endsamples();
+    float saved[4][4];
+    matset(saved, transform);
+    Shader s = active_shader();
+    bind(shadowshader);
+    bindtex(buf, BLANK);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);
+    glDisable(GL_CULL_FACE);
+    for (Proxy& p : proxies) {
+        setmodel(p.matrix);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, p.query);
+        findbuf(proxymodel).draw();
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+    }
+    glEnable(GL_CULL_FACE);
+    glDepthFunc(GL_LESS);
+    glDepthMask(mode3d ? GL_TRUE : GL_FALSE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    setmodel(saved);
+    bind(s);
+    proxies.clear();
+    beginsamples();
+}
+
+// Steps that only move the model transform can't change how a held back
+// model would look, so they don't need it drawn first.
+static bool moves(const Step& step) {
+    switch (step.type) {
+        case STEP_BEGIN:
+        case STEP_END:
+        case STEP_ROTATE:
+        case STEP_SCALE:
+        case STEP_TRANSLATE:
+        case STEP_RENDER:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Whether a step changes more than the texture, so that whatever's been held
+// back to draw later has to be drawn before it. Shapes that only need another
+// texture and models drawn in place can go ahead of it; anything drawn in the
+// other mode, or blended on its own like particles, can't.
+static bool settles(const Step& step) {
+    if (moves(step)) return false;
+    switch (breakreason(step)) {
+        case LIBDRAW_CONST(TEXTURE_BREAK):
+            return false;
+        case LIBDRAW_CONST(DRAW_BREAK):
+            return step.type == STEP_TILEMAP || step.type == STEP_PARTICLES;
+        default:
+            return true;
     }
 }
 
 void flush(Model model) {
+    double start = stats_clock(), submitted = framecounts.submitms;
+    trace_begin("flush");
     Buffer& buf = findbuf(model);
+    clear_hiz();
+    if (steps.size()) {
+        framecounts.enqueuems += start - queuestart;
+        Image target = currentfbo();
+        if (sampling) framepixels[sampleslot] += (double)width(target) * height(target);
+    }
+    beginsamples();
     for (const Step& step : steps) {
-        if (stateful(step)) drawbuf(buf), buf.reset();
+        if (cull2d(step)) {
+            culled_count ++;
+            continue;
+        }
+        // translucent shapes are drawn later, so they don't end the batch
+        if (primitive3d(step) && (alpha < 1 || translucency)) {
+            Translucent t;
+            t.step = step;
+            matset(t.transform, transform);
+            t.color[0] = red, t.color[1] = green, t.color[2] = blue, t.color[3] = alpha;
+            t.orig = orig;
+            translucents.push(t);
+            continue;
+        }
+        if (stateful(step)) {
+            if (!buf.empty()) framecounts.breaks[breakreason(step)] ++;
+            drawbuf(buf), buf.reset();
+            if (settles(step)) drawdeferred(buf), drawproxies(buf), drawtranslucent(buf);
+        }
+        if (depthsorted && step.type == STEP_RENDER) {
+            ensure3d();
+            Deferred d;
+            d.model = step.data.render.model;
+            d.img = step.data.render.img;
+            matset(d.transform, transform);
+            d.occlusion = occlusiontest(d.model);
+            choosedetail(d.model, d.img);
+            deferred.push(d);
+            continue;
+        }
         ::step(buf, step);
     }
     steps.clear();
     drawbuf(buf);
     buf.reset();
+    drawdeferred(buf);
+    drawproxies(buf);
+    drawtranslucent(buf);
+    endsamples();
+    // everything outside of draws is building geometry and state
+    framecounts.tessellatems += stats_clock() - start - (framecounts.submitms - submitted);
+    trace_end();
 }
 
 void init_queue() {
     rendermodel = init_render_buffer();
+
+    // a unit cube for occlusion queries, scaled to each model's bounds
+    static const int faces[6][4] = {
+        { 0, 1, 3, 2 }, { 4, 6, 7, 5 }, { 0, 4, 5, 1 },
+        { 2, 3, 7, 6 }, { 0, 2, 6, 4 }, { 1, 5, 7, 3 }
+    };
+    static const int corners[6] = { 0, 1, 2, 0, 2, 3 };
+    proxymodel = create_new_model();
+    Buffer& box = findbuf(proxymodel);
+    for (const auto& face : faces) for (int c : corners) {
+        int v = face[c];
+        box.pos(v & 1, v >> 1 & 1, v >> 2);
+        box.col(1, 1, 1, 1);
+        box.norm(0, 0, 1);
+        box.uv(0, 0);
+        box.spr(0, 0, 1, 1);
+    }
+    shadowshader = LIBDRAW_SYMBOL(shader)(LIBDRAW_CONST(DEFAULT_VSH), SHADOW_FSH);
+
+    // comparisons are set on a sampler, so the depth image can still be read
+    // as a plain texture everywhere else
+    glGenSamplers(1, &shadowsampler);
+    glSamplerParameteri(shadowsampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadowsampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadowsampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(shadowsampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(shadowsampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glSamplerParameteri(shadowsampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+}
+
+static void finish_samples() {
+    sampleslot = (sampleslot + 1) % OVERDRAW_FRAMES;
+    vector<GLuint>& oldest = samplequeries[sampleslot];
+    double pixels = framepixels[sampleslot];
+    framepixels[sampleslot] = 0;
+    if (!oldest.size()) return;
+
+    GLint ready = 0;
+    glGetQueryObjectiv(oldest.back(), GL_QUERY_RESULT_AVAILABLE, &ready);
+    if (ready) {
+        double samples = 0;
+        for (GLuint query : oldest) {
+            GLuint count = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT, &count);
+            samples += count;
+        }
+        overdraw_last = pixels > 0 ? samples / pixels : 0;
+    }
+    for (GLuint query : oldest) freequeries.push(query);
+    oldest.clear();
+}
+
+void finish_frame() {
+    release_targets();
+    clear_lights();
+    culled_last = culled_count;
+    culled_count = 0;
+    occluded_last = occluded_count;
+    occluded_count = 0;
+    finish_stats();
+    finish_timers();
+    for (u32& count : rendercounts) count = 0;
+    lodcount = 0;
+    occlusionframe ++;
+
+    finish_samples();
 }
 
 Model getrendermodel() {
@@ -1858,6 +2806,22 @@ void stretched_sprite(float x, float y, float w, float h, Image img) {
     enqueue(step);
 }
 
+extern "C" int LIBDRAW_SYMBOL(culled)() {
+    return culled_last;
+}
+
+extern "C" int LIBDRAW_SYMBOL(occluded)() {
+    return occluded_last;
+}
+
+extern "C" void LIBDRAW_SYMBOL(measureoverdraw)(bool enabled) {
+    sampling = enabled;
+}
+
+extern "C" float LIBDRAW_SYMBOL(overdraw)() {
+    return overdraw_last;
+}
+
 extern "C" void LIBDRAW_SYMBOL(font)(Image i) {
     Step step;
     step.type = STEP_FONT;
@@ -1883,6 +2847,13 @@ extern "C" void LIBDRAW_SYMBOL(wraptext)(float x, float y, const char* str, int
     enqueue(step);
 }
 
+extern "C" void LIBDRAW_SYMBOL(drawtiles)(Tilemap map, float x, float y) {
+    Step step;
+    step.type = STEP_TILEMAP;
+    step.data.tilemap = { map, x, y };
+    enqueue(step);
+}
+
 // 3D Drawing
 
 extern "C" Texture LIBDRAW_SYMBOL(actex)(Image img) {
@@ -1923,6 +2894,59 @@ extern "C" void LIBDRAW_SYMBOL(board)(float x, float y, float z, Image img) {
     enqueue(step);
 }
 
+extern "C" void LIBDRAW_SYMBOL(emit)(Emitter e, int count, float x, float y, float z, float vx, float vy, float vz, float spread, float life) {
+    Step step;
+    step.type = STEP_EMIT;
+    step.data.emit = { e, count, x, y, z, vx, vy, vz, spread, life };
+    enqueue(step);
+}
+
+extern "C" void LIBDRAW_SYMBOL(particles)(Emitter e) {
+    Step step;
+    step.type = STEP_PARTICLES;
+    step.data.particles = { e };
+    enqueue(step);
+}
+
+extern "C" void LIBDRAW_SYMBOL(instancing)(bool enabled) {
+    Step step;
+    step.type = STEP_INSTANCING;
+    step.data.instancing = { enabled };
+    enqueue(step);
+}
+
+extern "C" void LIBDRAW_SYMBOL(autolod)(bool enabled) {
+    Step step;
+    step.type = STEP_AUTO_LOD;
+    step.data.auto_lod = { enabled };
+    enqueue(step);
+}
+
+extern "C" void LIBDRAW_SYMBOL(depthsort)(bool enabled, bool prepass) {
+    Step step;
+    step.type = STEP_DEPTH_SORT;
+    step.data.depth_sort = { enabled, prepass };
+    enqueue(step);
+}
+
+extern "C" void LIBDRAW_SYMBOL(translucent)(bool enabled) {
+    Step step;
+    step.type = STEP_TRANSLUCENT;
+    step.data.translucent = { enabled };
+    enqueue(step);
+}
+
+extern "C" void LIBDRAW_SYMBOL(occluder)(Model model, bool enabled) {
+    findbuf(model).occluder = enabled;
+}
+
+extern "C" void LIBDRAW_SYMBOL(occlusion)(bool enabled) {
+    Step step;
+    step.type = STEP_OCCLUSION;
+    step.data.occlusion = { enabled };
+    enqueue(step);
+}
+
 extern "C" void LIBDRAW_SYMBOL(slant)(float x, float y, float z, float w, float h, float l, Edge edge, Texture img) {
     Step step;
     step.type = STEP_SLANT;
@@ -1938,7 +2962,7 @@ extern "C" void LIBDRAW_SYMBOL(prism)(float x, float y, float z, float w, float
 }
 
 extern "C" void LIBDRAW_SYMBOL(cylinder)(float x, float y, float z, float w, float h, float l, Axis axis, Texture img) {
-    prism(x, y, z, w, h, l, 32, axis, img);
+    prism(x, y, z, w, h, l, 0, axis, img);
 }
 
 extern "C" void LIBDRAW_SYMBOL(pyramid)(float x, float y, float z, float w, float h, float l, int n, Direction dir, Texture img) {
@@ -1949,7 +2973,7 @@ extern "C" void LIBDRAW_SYMBOL(pyramid)(float x, float y, float z, float w, floa
 }
 
 extern "C" void LIBDRAW_SYMBOL(cone)(float x, float y, float z, float w, float h, float l, Direction dir, Texture img) {
-    pyramid(x, y, z, w, h, l, 32, dir, img);
+    pyramid(x, y, z, w, h, l, 0, dir, img);
 }
 
 extern "C" void LIBDRAW_SYMBOL(hedron)(float x, float y, float z, float w, float h, float l, int m, int n, Texture img) {
@@ -1960,7 +2984,7 @@ extern "C" void LIBDRAW_SYMBOL(hedron)(float x, float y, float z, float w, float
 }
 
 extern "C" void LIBDRAW_SYMBOL(sphere)(float x, float y, float z, float w, float h, float l, Texture img) {
-    hedron(x, y, z, w, h, l, 16, 8, img);
+    hedron(x, y, z, w, h, l, 0, 0, img);
 }
 
 // Transformation
@@ -2123,8 +3147,10 @@ extern "C" void LIBDRAW_SYMBOL(uniformv4)(Shader shader, const char* name, float
 extern "C" void LIBDRAW_SYMBOL(paint)(Image img) {
     Image i = currentfbo();
     bindfbo(img);
+    begin_timer("paint");
     flush(rendermodel);
-    bindfbo(i);
+    end_timer();
+    bindfbo(i, true);
 }
 
 extern "C" void LIBDRAW_SYMBOL(shade)(Image img, Shader shader) {
@@ -2132,9 +3158,11 @@ extern "C" void LIBDRAW_SYMBOL(shade)(Image img, Shader shader) {
     Shader s = active_shader();
     bind(shader);
     bindfbo(img);
+    begin_timer("shade");
     flush(rendermodel);
+    end_timer();
     bind(s);
-    bindfbo(i);
+    bindfbo(i, true);
 }
 
 extern "C" void LIBDRAW_SYMBOL(fog)(Color color, float range) {
@@ -2155,15 +3183,114 @@ extern "C" Model LIBDRAW_SYMBOL(createmodel)() {
     return create_new_model();
 }
 
+// Each view of an impostor is a square of the atlas, this many pixels across.
+static const int IMPOSTOR_SIZE = 128;
+static const int MAX_IMPOSTOR_VIEWS = 32;
+
+// Views and atlases of impostors that have been replaced, kept to be reused
+// by the next impostor() instead of making new ones.
+static vector<Model> freesides;
+static vector<Image> freeatlases;
+
+static void dropimpostors(Buffer& b) {
+    if (!b.impostors.size()) return;
+    for (Model side : b.impostors) findbuf(side).reset(), freesides.push(side);
+    freeatlases.push(b.impostorimg);
+    b.impostors.clear();
+}
+
+// An atlas for this many views, cleared the way a new image is.
+static Image impostoratlas(int views) {
+    int w = views * IMPOSTOR_SIZE;
+    for (u32 i = 0; i < freeatlases.size(); i ++) {
+        Image atlas = freeatlases[i];
+        if (LIBDRAW_SYMBOL(width)(atlas) != w) continue;
+        freeatlases[i] = freeatlases.back(), freeatlases.pop();
+        cleartexture(findimg(atlas).id, 1, 1, 1, 1);
+        return atlas;
+    }
+    return LIBDRAW_SYMBOL(formatimage)(w, IMPOSTOR_SIZE, LIBDRAW_CONST(RGBA8_FORMAT));
+}
+
 extern "C" void LIBDRAW_SYMBOL(sketchto)(Model model) {
+    double start = stats_clock(), submitted = framecounts.submitms;
+    if (steps.size()) framecounts.enqueuems += start - queuestart;
     Buffer& buf = findbuf(model);
     buf.reset();
+    buf.lods.clear();
+    dropimpostors(buf);
 
     for (const Step& step : steps) {
         if (stateful(step)) drawbuf(buf), buf.reset();
         ::step(buf, step);
     }
     steps.clear();
+    framecounts.tessellatems += stats_clock() - start - (framecounts.submitms - submitted);
+}
+
+// The views are drawn side by side into the atlas in one pass, with an
+// orthographic camera looking down -z. Each copy of the model is turned so
+// the side seen from its view's angle faces the camera, and shrunk to fit a
+// 2 by 2 square. Anything already queued is held back until afterwards.
+extern "C" void LIBDRAW_SYMBOL(impostor)(Model model, Image img, int views, float distance) {
+    if (views < 1) views = 1;
+    if (views > MAX_IMPOSTOR_VIEWS) views = MAX_IMPOSTOR_VIEWS;
+    Buffer& b = findbuf(model);
+    dropimpostors(b);
+    if (b.dirty) b.bake();
+    float dx = b.hi[0] - b.lo[0], dy = b.hi[1] - b.lo[1], dz = b.hi[2] - b.lo[2];
+    float r = sqrt(dx * dx + dy * dy + dz * dz) / 2;
+    float c[3] = { b.center[0], b.center[1], b.center[2] };
+    if (r <= 0) return;
+
+    static vector<Step> pending;
+    pending.clear();
+    for (const Step& step : steps) pending.push(step);
+    steps.clear();
+    float savedproj[4][4], savedview[4][4], savedtransform[4][4];
+    matset(savedproj, projection);
+    matset(savedview, view);
+    matset(savedtransform, transform);
+    float savednear = near, savedfar = far;
+
+    Image atlas = impostoratlas(views);
+    LIBDRAW_SYMBOL(ortho)(views * 2, 2);
+    LIBDRAW_SYMBOL(snap)(0, 0, 0);
+    for (int i = 0; i < views; i ++) {
+        LIBDRAW_SYMBOL(beginstate)();
+        LIBDRAW_SYMBOL(translate)(-c[0], -c[1], -c[2]);
+        LIBDRAW_SYMBOL(rotate)(-360.0f * i / views, LIBDRAW_CONST(Y_AXIS));
+        LIBDRAW_SYMBOL(scale)(1 / r);
+        LIBDRAW_SYMBOL(translate)(1 + 2 * i, 1, 0);
+        LIBDRAW_SYMBOL(render)(model, img);
+        LIBDRAW_SYMBOL(endstate)();
+    }
+    LIBDRAW_SYMBOL(paint)(atlas);
+
+    matset(projection, savedproj);
+    matset(view, savedview);
+    matset(transform, savedtransform);
+    near = savednear, far = savedfar;
+    recalc_boards();
+    apply_default_uniforms();
+    for (const Step& step : pending) steps.push(step);
+
+    // a board the size of the model's bounding sphere, at its center
+    for (int i = 0; i < views; i ++) {
+        Model side;
+        if (freesides.size()) side = freesides.back(), freesides.pop();
+        else side = create_new_model();
+        Buffer& v = findbuf(side);
+        float record[BOARD_INSTANCE] = {
+            c[0], c[1], c[2], 2 * r, 2 * r, 0.5f, 0.5f,
+            1, 1, 1, 1,
+            float(i) / views, 0, 1.0f / views, 1
+        };
+        v.instance(v.boards, record, BOARD_INSTANCE);
+        findbuf(model).impostors.push(side);
+    }
+    findbuf(model).impostorimg = atlas;
+    findbuf(model).impostordistance = distance;
 }
 
 extern "C" Model LIBDRAW_SYMBOL(sketch)() {
@@ -2173,7 +3300,9 @@ extern "C" Model LIBDRAW_SYMBOL(sketch)() {
 }
 
 extern "C" void LIBDRAW_SYMBOL(flush)() {
+    begin_timer("flush");
     flush(rendermodel);
+    end_timer();
 }
 
 extern "C" void LIBDRAW_SYMBOL(render)(Model model, Image img) {
@@ -2183,6 +3312,12 @@ extern "C" void LIBDRAW_SYMBOL(render)(Model model, Image img) {
     enqueue(step);
 }
 
+extern "C" void LIBDRAW_SYMBOL(renderinstances)() {
+    Step step;
+    step.type = STEP_INSTANCES;
+    enqueue(step);
+}
+
 extern "C" float LIBDRAW_SYMBOL(lightdirx)() {
     return lightx;
 }
@@ -2202,6 +3337,109 @@ extern "C" void LIBDRAW_SYMBOL(setlightdir)(float x, float y, float z) {
     enqueue(step);
 }
 
+// Builds an orthographic view looking down the light direction, centered on
+// (x, y, z) and reaching radius units to each side. The depth range extends
+// further towards the light, so that things outside the area can still cast
+// shadows into it. The center is snapped to whole texels of the map, so the
+// shadows don't shimmer as it follows the camera.
+static void lightview(float lview[4][4], float lproj[4][4], float x, float y, float z, float radius, int size) {
+    float fx = lightx, fy = lighty, fz = lightz;
+    normalize(fx, fy, fz);
+    float ux = 0, uy = 1, uz = 0;
+    if (fabs(fy) > 0.99f) uy = 0, uz = 1;
+    float rx = fy * uz - fz * uy, ry = fz * ux - fx * uz, rz = fx * uy - fy * ux;
+    normalize(rx, ry, rz);
+    ux = ry * fz - rz * fy, uy = rz * fx - rx * fz, uz = rx * fy - ry * fx;
+
+    float texel = 2 * radius / size;
+    float cr = floor((rx * x + ry * y + rz * z) / texel) * texel;
+    float cu = floor((ux * x + uy * y + uz * z) / texel) * texel;
+    float cf = fx * x + fy * y + fz * z;
+    float v[4][4] = {
+        { rx, ux, -fx, 0 },
+        { ry, uy, -fy, 0 },
+        { rz, uz, -fz, 0 },
+        { -cr, -cu, cf, 1 }
+    };
+    matset(lview, v);
+
+    float n = -4 * radius, f = radius;
+    float p[4][4] = {
+        { 1 / radius, 0, 0, 0 },
+        { 0, 1 / radius, 0, 0 },
+        { 0, 0, -2 / (f - n), 0 },
+        { 0, 0, -(f + n) / (f - n), 1 }
+    };
+    matset(lproj, p);
+}
+
+// Draws everything queued so far into a depth image from the point of view of
+// the light, then has the default shader darken whatever that image shows to
+// be hidden from the light, until noshadows() is called.
+extern "C" void LIBDRAW_SYMBOL(shadowmap)(Image map, float x, float y, float z, float radius) {
+    if (imgformat(map) != LIBDRAW_CONST(DEPTH_FORMAT)) {
+        println("Shadow maps must be drawn to DEPTH_FORMAT images!");
+        return;
+    }
+
+    // the light direction is whatever the queued steps will leave it as
+    for (const Step& s : steps) if (s.type == STEP_SET_LIGHT)
+        lightx = s.data.set_light.x, lighty = s.data.set_light.y, lightz = s.data.set_light.z;
+
+    float savedproj[4][4], savedview[4][4];
+    matset(savedproj, projection);
+    matset(savedview, view);
+    lightview(view, projection, x, y, z, radius, width(map));
+
+    Image i = currentfbo();
+    Shader s = active_shader();
+    bind(shadowshader);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2, 4);
+    bindfbo(map);
+    shadowpass = true;
+    flush(rendermodel);
+    shadowpass = false;
+    glDisable(GL_POLYGON_OFFSET_FILL);
+
+    float bias[4][4] = {
+        { 0.5f, 0, 0, 0 },
+        { 0, 0.5f, 0, 0 },
+        { 0, 0, 0.5f, 0 },
+        { 0.5f, 0.5f, 0.5f, 1 }
+    };
+    matset(shadowmatrix, view);
+    matmult(shadowmatrix, projection);
+    matmult(shadowmatrix, bias);
+    matset(projection, savedproj);
+    matset(view, savedview);
+    recalc_boards();
+    Buffer& buf = findbuf(rendermodel);
+    for (const Step& c : shadowcamera) ::step(buf, c);
+    shadowcamera.clear();
+    hasshadows = true;
+
+    glActiveTexture(GL_TEXTURE0 + SHADOW_UNIT);
+    glBindTexture(GL_TEXTURE_2D, findimg(map).id);
+    framecounts.texturebinds ++;
+    glBindSampler(SHADOW_UNIT, shadowsampler);
+    glActiveTexture(GL_TEXTURE0);
+    bind(s);
+    bindfbo(i, true);
+
+    Step step;
+    step.type = STEP_SHADOWS;
+    step.data.shadows = { true };
+    enqueue(step);
+}
+
+extern "C" void LIBDRAW_SYMBOL(noshadows)() {
+    Step step;
+    step.type = STEP_SHADOWS;
+    step.data.shadows = { false };
+    enqueue(step);
+}
+
 void apply_default_uniforms() {
     glUniform1i(find_uniform("width"), width(currentfbo()));
     glUniform1i(find_uniform("height"), height(currentfbo()));
@@ -2212,4 +3450,7 @@ void apply_default_uniforms() {
     glUniformMatrix4fv(find_uniform("view"), 1, GL_FALSE, (const GLfloat*)view);
     glUniformMatrix4fv(find_uniform("model"), 1, GL_FALSE, (const GLfloat*)transform);
     glUniform1i(find_uniform("tex"), 0);
+    glUniform1i(find_uniform("shadows"), mode3d && shadowed);
+    glUniform1i(find_uniform("lights"), mode3d ? binned_lights() : 0);
+    glUniformMatrix4fv(find_uniform("shadow_matrix"), 1, GL_FALSE, (const GLfloat*)shadowmatrix);
 }
\ No newline at end of file
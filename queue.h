@@ -15,6 +15,7 @@ enum StepType {
     STEP_FONT,
     STEP_TEXT,
     STEP_WRAPPED_TEXT,
+    STEP_TILEMAP,
     STEP_CUBE, 
     STEP_BOARD,
     STEP_SLANT,
@@ -40,7 +41,16 @@ enum StepType {
     STEP_UNIFORMV2,
     STEP_UNIFORMV3,
     STEP_UNIFORMV4,
-    STEP_UNIFORMTEX
+    STEP_UNIFORMTEX,
+    STEP_INSTANCING,
+    STEP_EMIT,
+    STEP_PARTICLES,
+    STEP_SHADOWS,
+    STEP_DEPTH_SORT,
+    STEP_TRANSLUCENT,
+    STEP_OCCLUSION,
+    STEP_INSTANCES,
+    STEP_AUTO_LOD
 };
 
 struct Step {
@@ -54,6 +64,7 @@ struct Step {
         struct { Image img; } font;
         struct { float x, y; const char* str; } text;
         struct { float x, y; const char* str; float width; } wraptext;
+        struct { Tilemap map; float x, y; } tilemap;
         struct { float x, y, z, w, h, l; Texture tex; } cube;
         struct { float x, y, z, w, h, l; Edge edge; Texture tex; } slant;
         struct { float x, y, z, w, h, l; int n; Axis axis; Texture tex; } prism;
@@ -78,6 +89,14 @@ struct Step {
         struct { Shader shader; const char* name; float x, y, z, w; } uniformv4;
         struct { Shader shader; const char* name; int id; Image i; } uniformtex;
         struct { float x, y, z; } set_light;
+        struct { bool enabled; } instancing;
+        struct { Emitter emitter; int count; float x, y, z, vx, vy, vz, spread, life; } emit;
+        struct { Emitter emitter; } particles;
+        struct { bool enabled; } shadows;
+        struct { bool enabled, prepass; } depth_sort;
+        struct { bool enabled; } translucent;
+        struct { bool enabled; } occlusion;
+        struct { bool enabled; } auto_lod;
     } data;
 };
 
@@ -88,6 +107,7 @@ void stretched_sprite(float x, float y, float w, float h, Image img);
 void ensure2d();
 void ensure3d();
 void init_queue();
+void finish_frame();
 Model getrendermodel();
 void apply_default_uniforms();
 
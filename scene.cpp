@@ -0,0 +1,195 @@
+#include "scene.h"
+#include "model.h"
+#include "math.h"
+#include "string.h"
+#include "lib/util/hash.h"
+
+// Instances are kept in a loose octree. Each node holds the instances whose
+// centers fall in its cell and that are no bigger than half of it, and its
+// bounds are twice the size of the cell, so everything it holds fits inside
+// them. An instance never straddles two nodes, so moving one only touches the
+// nodes above it.
+static const int MAX_DEPTH = 12;
+
+struct Node {
+    float center[3], half;
+    int parent, children[8];
+    int first, count;
+};
+
+static vector<InstanceMeta> instances;
+static vector<Instance> freeinstances;
+static vector<Node> nodes;
+static map<u64, int> batches;
+static int nbatches = 0;
+
+InstanceMeta& findinstance(Instance instance) {
+    return instances[instance];
+}
+
+static int newnode(int parent, const float center[3], float half) {
+    Node node;
+    for (int k = 0; k < 3; k ++) node.center[k] = center[k];
+    node.half = half, node.parent = parent;
+    node.first = -1, node.count = 0;
+    for (int& c : node.children) c = -1;
+    nodes.push(node);
+    return nodes.size() - 1;
+}
+
+// Bounds are taken from the model as it is when it's placed, with each corner
+// of its box moved by the instance's matrix.
+static void bound(InstanceMeta& in) {
+    Buffer& b = findbuf(in.model);
+    if (b.dirty) b.bake();
+    for (int i = 0; i < 8; i ++) {
+        float p[3] = { i & 1 ? b.hi[0] : b.lo[0], i & 2 ? b.hi[1] : b.lo[1], i & 4 ? b.hi[2] : b.lo[2] };
+        for (int k = 0; k < 3; k ++) {
+            float v = p[0] * in.matrix[0][k] + p[1] * in.matrix[1][k] + p[2] * in.matrix[2][k] + in.matrix[3][k];
+            if (!i || v < in.lo[k]) in.lo[k] = v;
+            if (!i || v > in.hi[k]) in.hi[k] = v;
+        }
+    }
+}
+
+static float extent(const InstanceMeta& in, float center[3]) {
+    float e = 0;
+    for (int k = 0; k < 3; k ++) {
+        center[k] = (in.lo[k] + in.hi[k]) / 2;
+        e = fmax(e, (in.hi[k] - in.lo[k]) / 2);
+    }
+    return e;
+}
+
+// Goes down from the root for as long as the instance fits in a child, making
+// nodes on the way, and links it into the last one.
+static void place(Instance i) {
+    InstanceMeta& in = instances[i];
+    float c[3], e = extent(in, c);
+    int n = 0;
+    for (int depth = 0; depth < MAX_DEPTH && e <= nodes[n].half / 2; depth ++) {
+        int octant = (c[0] > nodes[n].center[0]) | (c[1] > nodes[n].center[1]) << 1 | (c[2] > nodes[n].center[2]) << 2;
+        if (nodes[n].children[octant] < 0) {
+            float half = nodes[n].half / 2, center[3];
+            for (int k = 0; k < 3; k ++) center[k] = nodes[n].center[k] + (octant >> k & 1 ? half : -half);
+            int child = newnode(n, center, half);
+            nodes[n].children[octant] = child;
+        }
+        n = nodes[n].children[octant];
+    }
+    in.node = n, in.prev = -1, in.next = nodes[n].first;
+    if (in.next >= 0) instances[in.next].prev = i;
+    nodes[n].first = i;
+    for (int p = n; p >= 0; p = nodes[p].parent) nodes[p].count ++;
+}
+
+static void unlink(Instance i) {
+    InstanceMeta& in = instances[i];
+    if (in.prev >= 0) instances[in.prev].next = in.next;
+    else nodes[in.node].first = in.next;
+    if (in.next >= 0) instances[in.next].prev = in.prev;
+    for (int p = in.node; p >= 0; p = nodes[p].parent) nodes[p].count --;
+    in.node = -1;
+}
+
+// The root is doubled in size until it covers the instance, and everything
+// already placed is put back into the bigger tree. That happens less and less
+// often as the tree grows.
+static void insert(Instance i) {
+    float c[3], e = extent(instances[i], c);
+    if (nodes.size() == 0) newnode(-1, c, fmax(e * 2, 16.0f));
+    float half = nodes[0].half, center[3];
+    for (int k = 0; k < 3; k ++) center[k] = nodes[0].center[k];
+    bool grown = false;
+    while (e > half || fabs(c[0] - center[0]) > half || fabs(c[1] - center[1]) > half || fabs(c[2] - center[2]) > half)
+        half *= 2, grown = true;
+    if (grown) {
+        nodes.clear();
+        newnode(-1, center, half);
+        for (u32 j = 0; j < instances.size(); j ++) if (instances[j].alive && (Instance)j != i) place(j);
+    }
+    place(i);
+}
+
+static int batch(Model model, Image img) {
+    u64 key = (u64)(u32)model << 32 | (u32)img;
+    auto it = batches.find(key);
+    if (it != batches.end()) return it->second;
+    return batches[key] = nbatches ++;
+}
+
+// Each plane is (a, b, c, d), with the inside where ax + by + cz + d >= 0.
+// They're read straight out of the columns of the matrix.
+static float planes[6][4];
+
+// Returns -1 if the box is outside one of the planes in the mask, and
+// otherwise the planes in the mask the box isn't entirely inside of.
+static int classify(const float lo[3], const float hi[3], int mask) {
+    for (int p = 0; p < 6; p ++) if (mask & 1 << p) {
+        const float* plane = planes[p];
+        float farthest = plane[3], nearest = plane[3];
+        for (int k = 0; k < 3; k ++) {
+            farthest += plane[k] * (plane[k] > 0 ? hi[k] : lo[k]);
+            nearest += plane[k] * (plane[k] > 0 ? lo[k] : hi[k]);
+        }
+        if (farthest < 0) return -1;
+        if (nearest >= 0) mask &= ~(1 << p);
+    }
+    return mask;
+}
+
+// Planes a node is entirely inside of aren't tested again below it, so whole
+// branches in the middle of the view are taken without any tests at all.
+static void visit(int n, int mask, vector<Instance>& visible) {
+    const Node& node = nodes[n];
+    if (!node.count) return;
+    if (mask) {
+        float lo[3], hi[3];
+        for (int k = 0; k < 3; k ++) lo[k] = node.center[k] - 2 * node.half, hi[k] = node.center[k] + 2 * node.half;
+        mask = classify(lo, hi, mask);
+        if (mask < 0) return;
+    }
+    for (int i = node.first; i >= 0; i = instances[i].next)
+        if (!mask || classify(instances[i].lo, instances[i].hi, mask) >= 0) visible.push(i);
+    for (int c : node.children) if (c >= 0) visit(c, mask, visible);
+}
+
+void visible_instances(float mvp[4][4], vector<Instance>& visible) {
+    visible.clear();
+    if (nodes.size() == 0) return;
+    for (int k = 0; k < 3; k ++) for (int s = 0; s < 2; s ++) {
+        float* plane = planes[k * 2 + s];
+        for (int i = 0; i < 4; i ++) plane[i] = mvp[i][3] + (s ? -mvp[i][k] : mvp[i][k]);
+    }
+    visit(0, 63, visible);
+}
+
+extern "C" Instance LIBDRAW_SYMBOL(placeinstance)(Model model, Image img, const float* matrix) {
+    Instance i;
+    if (freeinstances.size()) i = freeinstances.back(), freeinstances.pop();
+    else instances.push({}), i = instances.size() - 1;
+    InstanceMeta& in = instances[i];
+    in.model = model, in.img = img, in.batch = batch(model, img);
+    in.alive = true, in.node = -1;
+    memcpy(in.matrix, matrix, sizeof(in.matrix));
+    bound(in);
+    insert(i);
+    return i;
+}
+
+extern "C" void LIBDRAW_SYMBOL(moveinstance)(Instance instance, const float* matrix) {
+    InstanceMeta& in = instances[instance];
+    if (!in.alive) return;
+    unlink(instance);
+    memcpy(in.matrix, matrix, sizeof(in.matrix));
+    bound(in);
+    insert(instance);
+}
+
+extern "C" void LIBDRAW_SYMBOL(removeinstance)(Instance instance) {
+    InstanceMeta& in = instances[instance];
+    if (!in.alive) return;
+    unlink(instance);
+    in.alive = false;
+    freeinstances.push(instance);
+}
\ No newline at end of file
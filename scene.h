@@ -0,0 +1,24 @@
+#ifndef _LIBDRAW_SCENE_H
+#define _LIBDRAW_SCENE_H
+
+#include "draw.h"
+#include "lib/util/vec.h"
+
+// A model placed once with its own matrix, and kept in the scene until it's
+// moved or removed. Bounds are in the space the matrix places it in. Batches
+// number each pairing of model and texture, so instances that can be drawn
+// together are easy to group.
+struct InstanceMeta {
+    Model model;
+    Image img;
+    int batch;
+    float matrix[4][4];
+    float lo[3], hi[3];
+    int node, prev, next;
+    bool alive;
+};
+
+InstanceMeta& findinstance(Instance instance);
+void visible_instances(float mvp[4][4], vector<Instance>& visible);
+
+#endif
\ No newline at end of file
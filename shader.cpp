@@ -5,9 +5,52 @@
 #include "lib/util/hash.h"
 #include "image.h"
 #include "queue.h"
+#include "programcache.h"
+#include "stats.h"
+#include "trace.h"
+#include "lib/GLFW/glfw3.h"
+#include "string.h"
 
-static vector<GLuint> shaders;
-static vector<map<string, GLint>> uniforms;
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+
+typedef void (APIENTRYP MaxCompilerThreadsProc)(GLuint count);
+
+struct Program {
+    GLuint id;
+    u32 synced;
+    map<string, GLint> uniforms;
+};
+
+struct UniformValue {
+    int count;
+    bool integer;
+    float f[4];
+    int i;
+};
+
+// Programs with every feature are kept in variants. Specialized programs, for
+// shaders built from DEFAULT_FSH, are keyed by features * NUM_VARIANTS + variant,
+// and their fragment stages by features alone. Stages are compiled the first
+// time a program missing from the program cache needs them.
+//
+// The base program is left to build in the background. It's pending until its
+// link status has been checked, and failed if that check turned up errors.
+struct ShaderMeta {
+    string vsrc, fsrc;
+    GLuint vsh, fsh;
+    u64 key;
+    bool defaultvsh, specializable, pending, failed;
+    u32 generation;
+    Program variants[NUM_VARIANTS];
+    map<u32, Program> specialized;
+    map<u32, GLuint> specializedfsh;
+    map<string, UniformValue> values;
+};
+
+static vector<ShaderMeta> shaders;
+static vector<Shader> freeshaders;
+static GLuint variantvsh[NUM_VARIANTS];
+static bool parallel = false;
 
 const char* LIBDRAW_CONST(DEFAULT_VSH) = R"(
     #version 330
@@ -37,6 +80,9 @@ const char* LIBDRAW_CONST(DEFAULT_VSH) = R"(
     }
 )";
 
+// Each feature can be compiled out by defining NO_<FEATURE> after the version
+// line, which is how the specialized variants of shaders using this source are
+// built. Compiled as-is, it has every feature.
 const char* LIBDRAW_CONST(DEFAULT_FSH) = R"(
     #version 330
     in vec4 v_col;
@@ -47,92 +93,559 @@ const char* LIBDRAW_CONST(DEFAULT_FSH) = R"(
     uniform sampler2D tex;
     uniform vec4 fog_color;
     uniform float fog_range;
+    uniform sampler2DShadow shadow_map;
+    uniform mat4 shadow_matrix;
+    uniform int shadows;
+
+    uniform samplerBuffer light_data;
+    uniform isamplerBuffer light_clusters;
+    uniform int lights;
+    uniform mat4 view;
+    uniform float near, far;
+    uniform int width, height;
+    const ivec3 CLUSTERS = ivec3(16, 8, 24);
 
     out vec4 color;
 
+    // Each tap compares against four texels at once, so the 3x3 grid of taps
+    // filters over a 4x4 texel footprint.
+    float lit(vec4 pos) {
+        vec3 s = (shadow_matrix * pos).xyz;
+        if (any(lessThan(s, vec3(0))) || any(greaterThan(s, vec3(1)))) return 1.0;
+        vec2 texel = 1.0 / vec2(textureSize(shadow_map, 0));
+        float sum = 0;
+        for (int i = -1; i <= 1; i ++) for (int j = -1; j <= 1; j ++)
+            sum += texture(shadow_map, vec3(s.xy + vec2(i, j) * texel, s.z));
+        return sum / 9.0;
+    }
+
+    // Only the lights binned into this fragment's cluster are visited. Each
+    // light is two texels of light_data: (position, radius) and (color,
+    // intensity).
+    vec3 pointlights(vec4 pos) {
+        float depth = -(view * pos).z;
+        float z = near > 0 ? log(max(depth, near) / near) / log(far / near) : (depth - near) / (far - near);
+        ivec3 c = ivec3(vec3(gl_FragCoord.xy / vec2(width, height), z) * vec3(CLUSTERS));
+        c = clamp(c, ivec3(0), CLUSTERS - 1);
+        int cluster = (c.z * CLUSTERS.y + c.y) * CLUSTERS.x + c.x;
+        int first = texelFetch(light_clusters, cluster * 2).r, count = texelFetch(light_clusters, cluster * 2 + 1).r;
+
+        vec3 sum = vec3(0);
+        for (int i = 0; i < count; i ++) {
+            int l = texelFetch(light_clusters, first + i).r;
+            vec4 p = texelFetch(light_data, l * 2), col = texelFetch(light_data, l * 2 + 1);
+            float bright = clamp(1.0 - distance(pos.xyz, p.xyz) / p.w, 0, 1);
+            sum += col.rgb * col.a * bright * bright;
+        }
+        return sum;
+    }
+
     void main() {
+    #ifndef NO_TEXTURE
         vec2 fract_uv = fract(v_uv);
         vec2 fixed_uv = vec2(v_spr.x + v_spr.z * fract_uv.x, v_spr.y + v_spr.w * fract_uv.y);
         color = v_col * texture2D(tex, fixed_uv);
+    #else
+        color = v_col;
+    #endif
+    #ifndef NO_DISCARD
         if (color.a <= 0.00390625) discard;
+    #endif
 
+    #ifndef NO_SHADOWS
+        if (shadows != 0) color.rgb *= mix(0.6, 1.0, lit(v_pos));
+    #endif
+    #ifndef NO_LIGHTS
+        if (lights > 0) color.rgb *= 1.0 + pointlights(v_pos);
+    #endif
+
+    #ifndef NO_FOG
         if (fog_range > 0.01) {
             float v_dist = sqrt(v_pos.x * v_pos.x + v_pos.y * v_pos.y + v_pos.z * v_pos.z);
             float fog_density = clamp((fog_range - v_dist) / fog_range, 0, 1);
             color = vec4(mix(fog_color.rgb, color.rgb, fog_density), color.a);
         }
+    #endif
     }
 )";
 
-Shader LIBDRAW_CONST(DEFAULT_SHADER);
+// Vertex stages for instanced geometry. Each instance is a single record, and
+// the vertices are generated here from gl_VertexID and constant tables that
+// mirror the tessellation done in queue.cpp. The outputs match DEFAULT_VSH, so
+// these can be linked against any fragment shader written for it.
 
-extern Shader LIBDRAW_SYMBOL(shader)(const char* vsrc, const char* fsrc) {
-    GLuint vsh = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fsh = glCreateShader(GL_FRAGMENT_SHADER);
+static const char* CUBE_VSH = R"(
+    #version 330
+    layout(location=5) in vec3 i_pos;
+    layout(location=6) in vec3 i_size;
+    layout(location=7) in vec4 i_col;
+    layout(location=8) in vec4 i_side;
+    layout(location=9) in vec4 i_top;
+    layout(location=10) in vec4 i_bottom;
+    layout(location=11) in vec4 i_dims;
+    layout(location=12) in vec3 i_extra;
+
+    uniform mat4 model, view, projection;
+    uniform vec3 light;
+
+    out vec4 v_col;
+    out vec2 v_uv;
+    out vec4 v_spr;
+    out vec4 v_pos;
+
+    const vec3 corners[36] = vec3[36](
+        vec3(-1, -1, -1), vec3(-1, -1, 1), vec3(-1, 1, 1), vec3(-1, 1, 1), vec3(-1, 1, -1), vec3(-1, -1, -1),
+        vec3(1, -1, 1), vec3(1, -1, -1), vec3(1, 1, -1), vec3(1, 1, -1), vec3(1, 1, 1), vec3(1, -1, 1),
+        vec3(-1, -1, 1), vec3(-1, -1, -1), vec3(1, -1, -1), vec3(1, -1, -1), vec3(1, -1, 1), vec3(-1, -1, 1),
+        vec3(-1, 1, -1), vec3(-1, 1, 1), vec3(1, 1, 1), vec3(1, 1, 1), vec3(1, 1, -1), vec3(-1, 1, -1),
+        vec3(1, -1, -1), vec3(-1, -1, -1), vec3(-1, 1, -1), vec3(-1, 1, -1), vec3(1, 1, -1), vec3(1, -1, -1),
+        vec3(-1, -1, 1), vec3(1, -1, 1), vec3(1, 1, 1), vec3(1, 1, 1), vec3(-1, 1, 1), vec3(-1, -1, 1)
+    );
+
+    const vec3 normals[6] = vec3[6](
+        vec3(-1, 0, 0), vec3(1, 0, 0), vec3(0, -1, 0), vec3(0, 1, 0), vec3(0, 0, -1), vec3(0, 0, 1)
+    );
 
-    GLint size = string(vsrc).size();
-    glShaderSource(vsh, 1, &vsrc, &size);
-    size = string(fsrc).size();
-    glShaderSource(fsh, 1, &fsrc, &size);
+    // autouv() and stretchuv() corner orders
+    const vec2 autocorners[6] = vec2[6](vec2(0, 0), vec2(1, 0), vec2(1, 1), vec2(1, 1), vec2(0, 1), vec2(0, 0));
+    const vec2 stretchcorners[6] = vec2[6](vec2(1, 0), vec2(0, 0), vec2(0, 1), vec2(0, 1), vec2(1, 1), vec2(1, 0));
 
+    void main() {
+        int face = gl_VertexID / 6, corner = gl_VertexID % 6;
+        v_pos = model * vec4(i_pos + 0.5 * i_size * corners[gl_VertexID], 1);
+        gl_Position = projection * view * v_pos;
+        float bright = (-dot(light, normalize(mat3(model) * normals[face])) + 2) / 3;
+        v_col = vec4(bright * i_col.rgb, i_col.a);
+
+        vec2 dims = i_dims.xy;
+        v_spr = i_side;
+        if (face == 2) v_spr = i_bottom, dims = i_extra.xy;
+        if (face == 3) v_spr = i_top, dims = i_dims.zw;
+
+        if (i_extra.z > 0.5) v_uv = stretchcorners[corner];
+        else {
+            vec3 lo = i_pos - 0.5 * i_size;
+            vec4 span = face < 2 ? vec4(lo.z, lo.y, i_size.z, i_size.y)
+                : face < 4 ? vec4(lo.z, lo.x, i_size.z, i_size.x)
+                : vec4(lo.x, lo.y, i_size.x, i_size.y);
+            float flip = (face == 1 || face == 2 || face == 4) ? -1 : 1;
+            v_uv = vec2(fract(flip * span.x / dims.x), fract(-span.y / dims.y)) + autocorners[corner] * span.zw / dims;
+        }
+    }
+)";
+
+// Boards are built facing the camera from the view matrix, so baked models
+// full of boards stay correct however the view is changed afterwards.
+static const char* BOARD_VSH = R"(
+    #version 330
+    layout(location=5) in vec3 i_pos;
+    layout(location=6) in vec4 i_rect;
+    layout(location=7) in vec4 i_col;
+    layout(location=8) in vec4 i_spr;
+
+    uniform mat4 model, view, projection;
+    uniform vec3 light;
+
+    out vec4 v_col;
+    out vec2 v_uv;
+    out vec4 v_spr;
+    out vec4 v_pos;
+
+    const vec2 corners[6] = vec2[6](vec2(1, 0), vec2(0, 0), vec2(0, 1), vec2(0, 1), vec2(1, 1), vec2(1, 0));
+
+    void main() {
+        vec3 h = normalize(vec3(view[0][0], view[1][0], view[2][0]));
+        vec3 v = -normalize(vec3(view[0][1], view[1][1], view[2][1]));
+        vec2 size = i_rect.xy * vec2(length(model[0].xyz), length(model[1].xyz));
+        vec2 c = corners[gl_VertexID];
+        v_pos = model * vec4(i_pos, 1) + vec4((c.x - i_rect.z) * size.x * h + (c.y - i_rect.w) * size.y * v, 0);
+        gl_Position = projection * view * v_pos;
+        float bright = (-dot(light, normalize(-cross(h, v))) + 2) / 3;
+        v_col = vec4(bright * i_col.rgb, i_col.a);
+        v_uv = c;
+        v_spr = i_spr;
+    }
+)";
+
+// Covers the whole target with a quad, for post-processing passes. UVs span
+// [0, 1) across the target, and the sprite rectangle is the whole texture.
+static const char* FULLSCREEN_VSH = R"(
+    #version 330
+    out vec4 v_col;
+    out vec2 v_uv;
+    out vec4 v_spr;
+    out vec4 v_pos;
+
+    const vec2 corners[6] = vec2[6](vec2(0, 0), vec2(1, 0), vec2(1, 1), vec2(1, 1), vec2(0, 1), vec2(0, 0));
+
+    void main() {
+        vec2 c = corners[gl_VertexID];
+        gl_Position = vec4(2.0 * c - 1.0, 0.0, 1.0);
+        v_pos = vec4(0);
+        v_col = vec4(1);
+        v_uv = c;
+        v_spr = vec4(0, 0, 1, 1);
+    }
+)";
+
+// The same as DEFAULT_VSH, for a model drawn many times in one call. Each
+// instance has a matrix of its own, read a column at a time, which places it
+// before the model matrix does.
+static const char* MODEL_VSH = R"(
+    #version 330
+    layout(location=0) in vec3 pos;
+    layout(location=1) in vec4 col;
+    layout(location=2) in vec3 norm;
+    layout(location=3) in vec2 uv;
+    layout(location=4) in vec4 spr;
+    layout(location=5) in vec4 i_x;
+    layout(location=6) in vec4 i_y;
+    layout(location=7) in vec4 i_z;
+    layout(location=8) in vec4 i_w;
+
+    uniform mat4 model, view, projection;
+    uniform vec3 light;
+
+    out vec4 v_col;
+    out vec2 v_uv;
+    out vec4 v_spr;
+    out vec4 v_pos;
+
+    void main() {
+        mat4 placed = model * mat4(i_x, i_y, i_z, i_w);
+        v_pos = placed * vec4(pos, 1);
+        gl_Position = projection * view * v_pos;
+        float bright = (-dot(light, normalize(mat3(placed) * norm)) + 2) / 3;
+        v_col = vec4(bright * col.rgb, col.a);
+        v_uv = uv;
+        v_spr = spr;
+    }
+)";
+
+static const char* VARIANT_SOURCES[NUM_VARIANTS] = {
+    nullptr, CUBE_VSH, BOARD_VSH, FULLSCREEN_VSH, MODEL_VSH
+};
+
+// A prologue is inserted right after the #version line, which has to stay
+// first in the source.
+static GLuint compile(GLenum type, const char* src, const char* prologue = nullptr) {
+    string full;
+    if (prologue) {
+        const char* version = strstr(src, "#version");
+        const char* rest = version ? strchr(version, '\n') : nullptr;
+        rest = rest ? rest + 1 : src;
+        for (const char* c = src; c < rest; c ++) full += *c;
+        full += prologue;
+        full += rest;
+        src = (const char*)full.raw();
+    }
+
+    GLuint sh = glCreateShader(type);
+    GLint size = string(src).size();
+    glShaderSource(sh, 1, &src, &size);
+
+    glCompileShader(sh);
+    return sh;
+}
+
+static void report(GLuint sh, const char* stage) {
     char log[1024];
     GLsizei length = 0;
     GLint status = GL_TRUE;
-    glCompileShader(vsh);
-    if (glGetShaderiv(vsh, GL_COMPILE_STATUS, &status), !status) {
-        glGetShaderInfoLog(vsh, 1024, &length, log);
-        println("Vertex shader error:\n", (const char*)log);
+    if (sh && (glGetShaderiv(sh, GL_COMPILE_STATUS, &status), !status)) {
+        glGetShaderInfoLog(sh, 1024, &length, log);
+        println(stage, (const char*)log);
     }
-    glCompileShader(fsh);
-    if (glGetShaderiv(fsh, GL_COMPILE_STATUS, &status), !status) {
-        glGetShaderInfoLog(fsh, 1024, &length, log);
-        println("Fragment shader error:\n", (const char*)log);
+}
+
+// Reserved samplers never move, so they're assigned once, when a program is
+// first linked or loaded.
+static void reserve_units(GLuint result) {
+    static const struct { const char* name; int unit; } reserved[] = {
+        { "shadow_map", SHADOW_UNIT },
+        { "light_data", LIGHT_DATA_UNIT },
+        { "light_clusters", LIGHT_CLUSTER_UNIT }
+    };
+    GLint current;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+    glUseProgram(result);
+    for (const auto& r : reserved) {
+        GLint loc = glGetUniformLocation(result, r.name);
+        if (loc >= 0) glUniform1i(loc, r.unit);
     }
+    glUseProgram(current);
+}
 
-    GLuint result = glCreateProgram();
+// Loads the program from the cache if it's there, in which case it's ready
+// right away. Otherwise, compiles any stage that hasn't been yet and links
+// them, without waiting on the driver for either - finish() does that. The
+// prologue goes into the fragment stage.
+static GLuint link(u64 key, const char* vsrc, GLuint& vsh, const char* fsrc, GLuint& fsh, const char* prologue, bool& cached) {
+    GLuint result = load_program(key);
+    cached = result;
+    if (cached) {
+        reserve_units(result);
+        return result;
+    }
+    if (!vsh) vsh = compile(GL_VERTEX_SHADER, vsrc);
+    if (!fsh) fsh = compile(GL_FRAGMENT_SHADER, fsrc, prologue);
+    result = glCreateProgram();
+    prepare_program(result);
     glAttachShader(result, vsh);
     glAttachShader(result, fsh);
     glLinkProgram(result);
-    shaders.push(result);
-    uniforms.push({});
-    return shaders.size() - 1;
+    return result;
+}
+
+// Checks a freshly linked program, printing whatever errors the driver found,
+// and caches it if it linked.
+static bool finish(GLuint program, GLuint vsh, GLuint fsh, u64 key) {
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        char log[1024];
+        GLsizei length = 0;
+        report(vsh, "Vertex shader error:\n");
+        report(fsh, "Fragment shader error:\n");
+        glGetProgramInfoLog(program, 1024, &length, log);
+        println("Shader link error:\n", (const char*)log);
+        return false;
+    }
+    save_program(key, program);
+    reserve_units(program);
+    return true;
+}
+
+// Variants and specializations are built when they're first drawn with, so
+// there's nothing to gain from not waiting on them.
+static GLuint build(const char* vsrc, GLuint& vsh, const char* fsrc, GLuint& fsh, const char* prologue = nullptr) {
+    bool cached;
+    u64 key = program_key(vsrc, fsrc, prologue);
+    GLuint result = link(key, vsrc, vsh, fsrc, fsh, prologue, cached);
+    if (!cached) finish(result, vsh, fsh, key);
+    return result;
+}
+
+Shader LIBDRAW_CONST(DEFAULT_SHADER);
+
+extern Shader LIBDRAW_SYMBOL(shader)(const char* vsrc, const char* fsrc) {
+    trace_begin("shader");
+    Shader handle = shaders.size();
+    if (freeshaders.size()) handle = freeshaders.back(), freeshaders.pop();
+    else shaders.push({});
+    ShaderMeta& meta = shaders[handle];
+    meta.vsrc = vsrc, meta.fsrc = fsrc;
+    meta.vsh = meta.fsh = 0;
+    meta.defaultvsh = vsrc == LIBDRAW_CONST(DEFAULT_VSH) || string(vsrc) == LIBDRAW_CONST(DEFAULT_VSH);
+    meta.specializable = fsrc == LIBDRAW_CONST(DEFAULT_FSH) || string(fsrc) == LIBDRAW_CONST(DEFAULT_FSH);
+    meta.generation = 0;
+    for (int i = 0; i < NUM_VARIANTS; i ++) meta.variants[i].id = 0, meta.variants[i].synced = 0;
+    bool cached;
+    meta.key = program_key(vsrc, fsrc, nullptr);
+    meta.variants[VARIANT_BASE].id = link(meta.key, vsrc, meta.vsh, fsrc, meta.fsh, nullptr, cached);
+    meta.pending = !cached, meta.failed = false;
+    trace_end();
+    return handle;
+}
+
+// Only drivers with parallel compilation can say whether a program is done
+// without blocking until it is. Elsewhere, this waits on the program - but
+// that's still put off until the shader is first needed.
+static bool ready(ShaderMeta& meta, bool wait) {
+    if (!meta.pending) return true;
+    GLuint id = meta.variants[VARIANT_BASE].id;
+    if (!wait && parallel) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &done);
+        if (!done) return false;
+    }
+    meta.pending = false;
+    trace_begin("shader finish");
+    meta.failed = !finish(id, meta.vsh, meta.fsh, meta.key);
+    trace_end();
+    return true;
+}
+
+extern "C" bool LIBDRAW_SYMBOL(shaderready)(Shader shader) {
+    return ready(shaders[shader], false);
+}
+
+void wait_shaders() {
+    for (ShaderMeta& meta : shaders) ready(meta, true);
+}
+
+static const char* FEATURE_DEFINES[] = {
+    "#define NO_TEXTURE\n", "#define NO_DISCARD\n", "#define NO_FOG\n", "#define NO_SHADOWS\n", "#define NO_LIGHTS\n"
+};
+
+// Variants share the fragment stage of their shader, and are only linked the
+// first time they're drawn with. The same goes for feature specializations.
+static Program& find_program(Shader shader, int variant, int features = ALL_FEATURES) {
+    ShaderMeta& meta = shaders[shader];
+    if (!meta.specializable) features = ALL_FEATURES;
+    if (features == ALL_FEATURES) {
+        Program& program = meta.variants[variant];
+        if (!program.id) program.id = build(VARIANT_SOURCES[variant], variantvsh[variant], (const char*)meta.fsrc.raw(), meta.fsh);
+        return program;
+    }
+
+    u32 key = features * NUM_VARIANTS + variant;
+    auto it = meta.specialized.find(key);
+    if (it != meta.specialized.end()) return it->second;
+    string prologue;
+    for (int i = 0; i < 5; i ++) if (!(features & 1 << i)) prologue += FEATURE_DEFINES[i];
+    GLuint fsh = meta.specializedfsh[features];
+    GLuint id = variant == VARIANT_BASE
+        ? build((const char*)meta.vsrc.raw(), meta.vsh, LIBDRAW_CONST(DEFAULT_FSH), fsh, (const char*)prologue.raw())
+        : build(VARIANT_SOURCES[variant], variantvsh[variant], LIBDRAW_CONST(DEFAULT_FSH), fsh, (const char*)prologue.raw());
+    meta.specializedfsh[features] = fsh;
+    Program& program = meta.specialized[key];
+    program.id = id;
+    program.synced = 0;
+    return program;
 }
 
 GLuint find_shader(Shader shader) {
-    return shaders[shader];
+    return shaders[shader].variants[VARIANT_BASE].id;
 }
 
+bool default_vertex(Shader shader) {
+    return shaders[shader].defaultvsh;
+}
+
+// Drivers with parallel compilation get as many threads as they like, so
+// shaders created together build at the same time.
 void init_shaders() {
+    const char* ext[][2] = {
+        { "GL_KHR_parallel_shader_compile", "glMaxShaderCompilerThreadsKHR" },
+        { "GL_ARB_parallel_shader_compile", "glMaxShaderCompilerThreadsARB" }
+    };
+    for (const auto& e : ext) if (!parallel && glfwExtensionSupported(e[0])) {
+        MaxCompilerThreadsProc threads = (MaxCompilerThreadsProc)glfwGetProcAddress(e[1]);
+        if (threads) threads(0xffffffff), parallel = true;
+    }
     LIBDRAW_CONST(DEFAULT_SHADER) = shader(LIBDRAW_CONST(DEFAULT_VSH), LIBDRAW_CONST(DEFAULT_FSH));
 }
 
 static Shader active;
+static int activevariant = VARIANT_BASE, activefeatures = ALL_FEATURES;
 
 Shader active_shader() {
     return active;
 }
 
+static GLint find_uniform(Program& program, const string& name) {
+    auto it = program.uniforms.find(name);
+    if (it != program.uniforms.end()) return it->second;
+    return program.uniforms[name] = glGetUniformLocation(program.id, (const GLchar*)name.raw());
+}
+
 GLint find_uniform(Shader shader, const string& name) {
-    auto it = uniforms[shader].find(name);
-    if (it != uniforms[shader].end()) return it->second;
-    return uniforms[shader][name] = glGetUniformLocation(shaders[shader], (const GLchar*)name.raw());
+    return find_uniform(shaders[shader].variants[VARIANT_BASE], name);
 }
 
 GLint find_uniform(const string& name) {
-    return find_uniform(active, name);
+    return find_uniform(find_program(active, activevariant, activefeatures), name);
 }
 
+// Uniforms set through set_uniform*() are remembered per shader, so that every
+// variant of the shader sees the same values once it's bound.
+static void sync(ShaderMeta& meta, Program& program) {
+    if (program.synced == meta.generation) return;
+    program.synced = meta.generation;
+    for (const auto& entry : meta.values) {
+        GLint loc = find_uniform(program, entry.first);
+        const UniformValue& v = entry.second;
+        if (v.integer) glUniform1i(loc, v.i);
+        else if (v.count == 1) glUniform1f(loc, v.f[0]);
+        else if (v.count == 2) glUniform2f(loc, v.f[0], v.f[1]);
+        else if (v.count == 3) glUniform3f(loc, v.f[0], v.f[1], v.f[2]);
+        else glUniform4f(loc, v.f[0], v.f[1], v.f[2], v.f[3]);
+    }
+}
+
+static void set_uniform(Shader shader, const string& name, const UniformValue& value) {
+    ShaderMeta& meta = shaders[shader];
+    meta.values[name] = value;
+    meta.generation ++;
+    if (shader == active) sync(meta, find_program(active, activevariant, activefeatures));
+}
+
+void set_uniformi(Shader shader, const string& name, int i) {
+    set_uniform(shader, name, { 1, true, { 0, 0, 0, 0 }, i });
+}
+
+void set_uniformf(Shader shader, const string& name, float x) {
+    set_uniform(shader, name, { 1, false, { x, 0, 0, 0 }, 0 });
+}
+
+void set_uniformv2(Shader shader, const string& name, float x, float y) {
+    set_uniform(shader, name, { 2, false, { x, y, 0, 0 }, 0 });
+}
+
+void set_uniformv3(Shader shader, const string& name, float x, float y, float z) {
+    set_uniform(shader, name, { 3, false, { x, y, z, 0 }, 0 });
+}
+
+void set_uniformv4(Shader shader, const string& name, float x, float y, float z, float w) {
+    set_uniform(shader, name, { 4, false, { x, y, z, w }, 0 });
+}
+
+// Shaders that are still building, or failed to, are stood in for by the
+// default shader.
 void bind(Shader shader) {
-    const static GLfloat identity[16] = {
-        1, 0, 0, 0,
-        0, 1, 0, 0,
-        0, 0, 1, 0,
-        0, 0, 0, 1
-    };
+    ShaderMeta& meta = shaders[shader];
+    if (!ready(meta, false) || meta.failed) shader = LIBDRAW_CONST(DEFAULT_SHADER);
     active = shader;
-    GLuint id = find_shader(shader);
-    glUseProgram(id);
+    activevariant = VARIANT_BASE, activefeatures = ALL_FEATURES;
+    Program& program = shaders[shader].variants[VARIANT_BASE];
+    glUseProgram(program.id);
+    framecounts.shaderbinds ++;
+    sync(shaders[shader], program);
 
     // default uniforms
     apply_default_uniforms();
+}
+
+void bind_variant(int variant) {
+    if (variant == activevariant) return;
+    activevariant = variant;
+    Program& program = find_program(active, variant, activefeatures);
+    glUseProgram(program.id);
+    framecounts.shaderbinds ++;
+    sync(shaders[active], program);
+    apply_default_uniforms();
+}
+
+// Switches to the smallest specialization of the active shader that still has
+// the given features. Does nothing for shaders that can't be specialized.
+void bind_features(int features) {
+    if (!shaders[active].specializable) features = ALL_FEATURES;
+    if (features == activefeatures) return;
+    activefeatures = features;
+    Program& program = find_program(active, activevariant, features);
+    glUseProgram(program.id);
+    framecounts.shaderbinds ++;
+    sync(shaders[active], program);
+    apply_default_uniforms();
+}
+
+// Puts back the program that's bound as far as the shader state knows, after
+// something else has used a program of its own.
+void rebind() {
+    glUseProgram(find_program(active, activevariant, activefeatures).id);
+}
+
+// Deletes everything built for a shader that won't be drawn with again, and
+// lets a later shader() take over its handle. The vertex stages of variants
+// are shared, and stay.
+void free_shader(Shader shader) {
+    ShaderMeta& meta = shaders[shader];
+    for (const Program& program : meta.variants) if (program.id) glDeleteProgram(program.id);
+    for (const auto& entry : meta.specialized) glDeleteProgram(entry.second.id);
+    for (const auto& entry : meta.specializedfsh) if (entry.second) glDeleteShader(entry.second);
+    if (meta.vsh) glDeleteShader(meta.vsh);
+    if (meta.fsh) glDeleteShader(meta.fsh);
+    meta = ShaderMeta();
+    freeshaders.push(shader);
 }
\ No newline at end of file
@@ -5,11 +5,54 @@
 #include "lib/GLAD/glad.h"
 #include "lib/util/str.h"
 
+// Texture units used by Libdraw's own samplers. Texture uniforms set by the
+// user should stay below these.
+enum ReservedUnit {
+    LIGHT_CLUSTER_UNIT = 12,
+    LIGHT_DATA_UNIT = 13,
+    SHADOW_UNIT = 14,
+    TILEMAP_UNIT = 15
+};
+
+// Alternate vertex stages a shader can be drawn with. Variants are linked
+// against the shader's own fragment stage.
+enum ShaderVariant {
+    VARIANT_BASE = 0,
+    VARIANT_CUBE = 1,
+    VARIANT_BOARD = 2,
+    VARIANT_FULLSCREEN = 3,
+    VARIANT_MODEL = 4,
+    NUM_VARIANTS = 5
+};
+
+// Optional parts of DEFAULT_FSH. Shaders using that fragment source are
+// specialized for each combination of features in use, so nothing is paid for
+// features that are off.
+enum ShaderFeature {
+    FEATURE_TEXTURE = 1,
+    FEATURE_DISCARD = 2,
+    FEATURE_FOG = 4,
+    FEATURE_SHADOWS = 8,
+    FEATURE_LIGHTS = 16,
+    ALL_FEATURES = 31
+};
+
 GLuint find_shader(Shader shader);
+bool default_vertex(Shader shader);
 void init_shaders();
+void wait_shaders();
 GLint find_uniform(Shader shader, const string& name);
 GLint find_uniform(const string& name);
+void set_uniformi(Shader shader, const string& name, int i);
+void set_uniformf(Shader shader, const string& name, float x);
+void set_uniformv2(Shader shader, const string& name, float x, float y);
+void set_uniformv3(Shader shader, const string& name, float x, float y, float z);
+void set_uniformv4(Shader shader, const string& name, float x, float y, float z, float w);
 Shader active_shader();
 void bind(Shader shader);
+void bind_variant(int variant);
+void bind_features(int features);
+void rebind();
+void free_shader(Shader shader);
 
 #endif
\ No newline at end of file
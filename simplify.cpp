@@ -0,0 +1,308 @@
+#include "simplify.h"
+#include "math.h"
+#include "string.h"
+#include "lib/util/hash.h"
+
+// Quadric error metrics: each vertex sums up the planes of the triangles
+// around it, as a symmetric 4x4 matrix, and the error of putting the vertex
+// somewhere is its squared distance to all of those planes. Edges are
+// collapsed cheapest first, in rounds with a rising threshold, and each
+// collapse moves one end onto the other, so no new positions are made up.
+//
+// Triangles keep their own colors, normals, UVs and sprite rects at each
+// corner. A corner that moves takes on those of the vertex it lands on, so
+// textures stay pinned to the vertices that are left. Edges
+// along the border of the mesh, or between triangles that disagree about
+// their sprite rect, color, or UVs (beyond whole repeats of the texture),
+// can't move, so seams and the edges of each sprite stay where they were.
+struct Quadric {
+    double m[10];
+};
+
+struct Vertex {
+    float p[3];
+    Quadric q;
+    int first, count;
+    bool locked;
+};
+
+struct Triangle {
+    int v[3];
+    double err[4];
+    float n[3];
+    bool deleted, dirty;
+};
+
+struct Ref {
+    int tri, corner;
+};
+
+struct Shared {
+    int tri, corner, count;
+};
+
+static vector<Vertex> vertices;
+static vector<Triangle> triangles;
+static vector<Ref> refs;
+static vector<float> cols, norms, uvs, sprs;
+
+static void addplane(Quadric& q, double a, double b, double c, double d) {
+    double terms[10] = { a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d };
+    for (int i = 0; i < 10; i ++) q.m[i] += terms[i];
+}
+
+static double evaluate(const Quadric& q, const float* p) {
+    double x = p[0], y = p[1], z = p[2];
+    const double* m = q.m;
+    return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+        + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+        + m[7] * z * z + 2 * m[8] * z + m[9];
+}
+
+static void normal(const float* a, const float* b, const float* c, float n[3]) {
+    float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+    n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+    n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+    n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+    float l = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (l > 0) for (int k = 0; k < 3; k ++) n[k] /= l;
+}
+
+// Vertices are shared by exact position, whatever else differs at them.
+static int weld(map<u64, int>& welds, const float* p) {
+    u64 key = raw_hash(p, sizeof(float) * 3);
+    while (true) {
+        auto it = welds.find(key);
+        if (it == welds.end()) break;
+        if (!memcmp(vertices[it->second].p, p, sizeof(float) * 3)) return it->second;
+        key ++;
+    }
+    Vertex v;
+    memcpy(v.p, p, sizeof(v.p));
+    memset(&v.q, 0, sizeof(v.q));
+    v.first = v.count = 0, v.locked = false;
+    vertices.push(v);
+    return welds[key] = vertices.size() - 1;
+}
+
+static bool samecorner(int t0, int c0, int t1, int c1) {
+    for (int k = 0; k < 4; k ++) if (cols[t0 * 12 + c0 * 4 + k] != cols[t1 * 12 + c1 * 4 + k]) return false;
+    for (int k = 0; k < 4; k ++) if (sprs[t0 * 12 + c0 * 4 + k] != sprs[t1 * 12 + c1 * 4 + k]) return false;
+    for (int k = 0; k < 2; k ++) {
+        float d = uvs[t0 * 6 + c0 * 2 + k] - uvs[t1 * 6 + c1 * 2 + k];
+        if (fabs(d - round(d)) > 1e-4f) return false;
+    }
+    return true;
+}
+
+// Borders are edges with one triangle, and seams are edges whose two
+// triangles don't agree at both ends. Edges with more than two triangles are
+// left alone too.
+static void lockedges() {
+    map<u64, Shared> edges;
+    for (u32 t = 0; t < triangles.size(); t ++) for (int c = 0; c < 3; c ++) {
+        int a = triangles[t].v[c], b = triangles[t].v[(c + 1) % 3];
+        u64 key = a < b ? (u64)a << 32 | b : (u64)b << 32 | a;
+        auto it = edges.find(key);
+        if (it == edges.end()) {
+            edges[key] = { (int)t, c, 1 };
+            continue;
+        }
+        Shared& e = it->second;
+        e.count ++;
+        const Triangle& other = triangles[e.tri];
+        int oa = other.v[e.corner] == a ? e.corner : (e.corner + 1) % 3;
+        int ob = other.v[e.corner] == b ? e.corner : (e.corner + 1) % 3;
+        if (e.count > 2 || !samecorner(t, c, e.tri, oa) || !samecorner(t, (c + 1) % 3, e.tri, ob))
+            vertices[a].locked = vertices[b].locked = true;
+    }
+    for (const auto& entry : edges) if (entry.second.count == 1) {
+        const Triangle& t = triangles[entry.second.tri];
+        vertices[t.v[entry.second.corner]].locked = vertices[t.v[(entry.second.corner + 1) % 3]].locked = true;
+    }
+}
+
+// The cost of collapsing an edge onto whichever end it's cheaper to keep.
+// keep is set to that end, 0 or 1.
+static double edgeerror(int i0, int i1, int& keep) {
+    const Vertex& v0 = vertices[i0];
+    const Vertex& v1 = vertices[i1];
+    Quadric q;
+    for (int i = 0; i < 10; i ++) q.m[i] = v0.q.m[i] + v1.q.m[i];
+    double e0 = v1.locked ? 1e30 : evaluate(q, v0.p), e1 = v0.locked ? 1e30 : evaluate(q, v1.p);
+    keep = e0 <= e1 ? 0 : 1;
+    return keep ? e1 : e0;
+}
+
+static void errors(Triangle& t) {
+    int keep;
+    for (int j = 0; j < 3; j ++) t.err[j] = edgeerror(t.v[j], t.v[(j + 1) % 3], keep);
+    t.err[3] = fmin(t.err[0], fmin(t.err[1], t.err[2]));
+}
+
+static void buildrefs() {
+    for (Vertex& v : vertices) v.count = 0;
+    for (const Triangle& t : triangles) if (!t.deleted) for (int v : t.v) vertices[v].count ++;
+    int start = 0;
+    for (Vertex& v : vertices) v.first = start, start += v.count, v.count = 0;
+    refs.clear();
+    for (int i = 0; i < start; i ++) refs.push({ 0, 0 });
+    for (u32 t = 0; t < triangles.size(); t ++) if (!triangles[t].deleted) for (int c = 0; c < 3; c ++) {
+        Vertex& v = vertices[triangles[t].v[c]];
+        refs[v.first + v.count ++] = { (int)t, c };
+    }
+}
+
+// Would moving vertex i to p turn any of its triangles over, or squash one
+// flat? Triangles that also hold other are the ones the collapse removes.
+static bool flips(int i, int other, const float* p, vector<bool>& removed) {
+    const Vertex& v = vertices[i];
+    removed.clear();
+    for (int r = 0; r < v.count; r ++) {
+        const Triangle& t = triangles[refs[v.first + r].tri];
+        int c = refs[v.first + r].corner;
+        removed.push(false);
+        if (t.deleted) continue;
+        int a = t.v[(c + 1) % 3], b = t.v[(c + 2) % 3];
+        if (a == other || b == other) {
+            removed.back() = true;
+            continue;
+        }
+        float n[3];
+        normal(p, vertices[a].p, vertices[b].p, n);
+        if (n[0] == 0 && n[1] == 0 && n[2] == 0) return true;
+        if (n[0] * t.n[0] + n[1] * t.n[1] + n[2] * t.n[2] < 0.2f) return true;
+    }
+    return false;
+}
+
+// Gives the corner of a triangle that's moving onto another vertex the
+// attributes that vertex has in a triangle the collapse removes, which holds
+// both. The edges around a vertex that can move aren't seams, so UVs only
+// differ between its triangles by whole repeats, which are kept.
+static void takecorner(int tri, int corner, int from, int fromcorner, int tocorner) {
+    for (int k = 0; k < 2; k ++) {
+        float repeat = round(uvs[tri * 6 + corner * 2 + k] - uvs[from * 6 + fromcorner * 2 + k]);
+        uvs[tri * 6 + corner * 2 + k] = uvs[from * 6 + tocorner * 2 + k] + repeat;
+    }
+    for (int k = 0; k < 4; k ++) cols[tri * 12 + corner * 4 + k] = cols[from * 12 + tocorner * 4 + k];
+    for (int k = 0; k < 3; k ++) norms[tri * 9 + corner * 3 + k] = norms[from * 9 + tocorner * 3 + k];
+}
+
+// Moves the surviving triangles of vertex i over to vertex keep, removing the
+// ones that collapsed, and queues their refs up under keep.
+static int retarget(int i, int keep, const vector<bool>& removed) {
+    Vertex& v = vertices[i];
+    int gone = 0;
+    for (int r = 0; r < v.count; r ++) {
+        Ref ref = refs[v.first + r];
+        Triangle& t = triangles[ref.tri];
+        if (t.deleted) continue;
+        if (removed[r]) {
+            t.deleted = true, gone ++;
+            continue;
+        }
+        t.v[ref.corner] = keep;
+        t.dirty = true;
+        normal(vertices[t.v[0]].p, vertices[t.v[1]].p, vertices[t.v[2]].p, t.n);
+        errors(t);
+        refs.push(ref);
+    }
+    return gone;
+}
+
+void simplify(const Buffer& in, Buffer& out, float ratio) {
+    vertices.clear(), triangles.clear();
+    cols.clear(), norms.clear(), uvs.clear(), sprs.clear();
+    map<u64, int> welds;
+    u32 ntris = in.verts.size() / 9;
+    for (u32 i = 0; i < ntris; i ++) {
+        Triangle t;
+        for (int c = 0; c < 3; c ++) t.v[c] = weld(welds, &in.verts[i * 9 + c * 3]);
+        if (t.v[0] == t.v[1] || t.v[1] == t.v[2] || t.v[0] == t.v[2]) continue;
+        t.deleted = t.dirty = false;
+        triangles.push(t);
+        for (int k = 0; k < 12; k ++) cols.push(in.cols[i * 12 + k]), sprs.push(in.sprs[i * 12 + k]);
+        for (int k = 0; k < 9; k ++) norms.push(in.norms[i * 9 + k]);
+        for (int k = 0; k < 6; k ++) uvs.push(in.uvs[i * 6 + k]);
+    }
+
+    for (Triangle& t : triangles) {
+        const float* a = vertices[t.v[0]].p;
+        normal(a, vertices[t.v[1]].p, vertices[t.v[2]].p, t.n);
+        double d = -(t.n[0] * a[0] + t.n[1] * a[1] + t.n[2] * a[2]);
+        for (int v : t.v) addplane(vertices[v].q, t.n[0], t.n[1], t.n[2], d);
+    }
+    lockedges();
+    for (Triangle& t : triangles) errors(t);
+
+    u32 target = ratio * triangles.size(), remaining = triangles.size();
+    vector<bool> removed0, removed1;
+    for (int pass = 0; pass < 100 && remaining > target; pass ++) {
+        buildrefs();
+        for (Triangle& t : triangles) t.dirty = false;
+        double threshold = 1e-9 * pow(pass + 3, 7.0);
+        for (u32 n = 0; n < triangles.size() && remaining > target; n ++) {
+            Triangle& t = triangles[n];
+            if (t.deleted || t.dirty || t.err[3] > threshold) continue;
+            for (int j = 0; j < 3; j ++) {
+                if (t.err[j] > threshold) continue;
+                int keep, i0 = t.v[j], i1 = t.v[(j + 1) % 3];
+                edgeerror(i0, i1, keep);
+                if (keep) i0 = t.v[(j + 1) % 3], i1 = t.v[j];
+                if (vertices[i1].locked) continue;
+
+                const float* p = vertices[i0].p;
+                if (flips(i1, i0, p, removed1) || flips(i0, i1, p, removed0)) continue;
+                Ref from = { -1, 0 };
+                for (int r = 0; r < vertices[i1].count; r ++) if (removed1[r] && !triangles[refs[vertices[i1].first + r].tri].deleted) from = refs[vertices[i1].first + r];
+                if (from.tri < 0) continue;
+                const Triangle& gone = triangles[from.tri];
+                int to = gone.v[(from.corner + 1) % 3] == i0 ? (from.corner + 1) % 3 : (from.corner + 2) % 3;
+                for (int r = 0; r < vertices[i1].count; r ++) {
+                    const Ref& ref = refs[vertices[i1].first + r];
+                    if (!triangles[ref.tri].deleted && !removed1[r]) takecorner(ref.tri, ref.corner, from.tri, from.corner, to);
+                }
+                for (int k = 0; k < 10; k ++) vertices[i0].q.m[k] += vertices[i1].q.m[k];
+
+                // vertex i0 keeps its place, so only its refs need gathering
+                // up again, followed by the ones it takes over from i1
+                int start = refs.size();
+                remaining -= retarget(i0, i0, removed0);
+                remaining -= retarget(i1, i0, removed1);
+                vertices[i0].first = start, vertices[i0].count = refs.size() - start;
+                break;
+            }
+        }
+    }
+
+    out.reset();
+    for (u32 n = 0; n < triangles.size(); n ++) {
+        const Triangle& t = triangles[n];
+        if (t.deleted) continue;
+        for (int c = 0; c < 3; c ++) {
+            const float* p = vertices[t.v[c]].p;
+            out.pos(p[0], p[1], p[2]);
+            out.col(cols[n * 12 + c * 4], cols[n * 12 + c * 4 + 1], cols[n * 12 + c * 4 + 2], cols[n * 12 + c * 4 + 3]);
+            out.norm(norms[n * 9 + c * 3], norms[n * 9 + c * 3 + 1], norms[n * 9 + c * 3 + 2]);
+            out.uv(uvs[n * 6 + c * 2], uvs[n * 6 + c * 2 + 1]);
+            out.spr(sprs[n * 12 + c * 4], sprs[n * 12 + c * 4 + 1], sprs[n * 12 + c * 4 + 2], sprs[n * 12 + c * 4 + 3]);
+        }
+    }
+    for (float f : in.cubes) out.cubes.push(f);
+    for (float f : in.boards) out.boards.push(f);
+}
+
+extern "C" Model LIBDRAW_SYMBOL(simplifymodel)(Model model, float ratio) {
+    Model result = create_new_model();
+    simplify(findbuf(model), findbuf(result), ratio < 0 ? 0 : ratio > 1 ? 1 : ratio);
+    return result;
+}
+
+extern "C" void LIBDRAW_SYMBOL(lodmodel)(Model model, int levels) {
+    findbuf(model).lods.clear();
+    for (Model level = model; levels > 0; levels --) {
+        level = LIBDRAW_SYMBOL(simplifymodel)(level, 0.5f);
+        findbuf(model).lods.push(level);
+    }
+}
\ No newline at end of file
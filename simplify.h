@@ -0,0 +1,11 @@
+#ifndef _LIBDRAW_SIMPLIFY_H
+#define _LIBDRAW_SIMPLIFY_H
+
+#include "model.h"
+
+// Fills out with a version of in that has about ratio as many triangles, by
+// collapsing the edges that change its shape the least. Cube and board
+// instance records are copied over as they are.
+void simplify(const Buffer& in, Buffer& out, float ratio);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+#include "sort.h"
+#include "string.h"
+
+// Least significant digit radix sort, eleven bits at a time. Floats are
+// flipped into unsigned integers that compare the same way: negative numbers
+// have every bit flipped, and positive ones just the sign.
+static const int DIGIT_BITS = 11, DIGITS = 1 << DIGIT_BITS;
+
+void sortkeys(const float* keys, u32 count, vector<u32>& order) {
+    static vector<u32> bits, scratch;
+    static u32 counts[DIGITS];
+    order.clear();
+    bits.clear(), scratch.clear();
+    for (u32 i = 0; i < count; i ++) {
+        u32 u;
+        memcpy(&u, keys + i, sizeof(u));
+        bits.push(u ^ (u >> 31 ? 0xffffffff : 0x80000000));
+        order.push(i), scratch.push(0);
+    }
+
+    u32 *from = order.begin(), *to = scratch.begin();
+    for (int shift = 0; shift < 32; shift += DIGIT_BITS) {
+        memset(counts, 0, sizeof(counts));
+        for (u32 i = 0; i < count; i ++) counts[bits[from[i]] >> shift & (DIGITS - 1)] ++;
+        u32 total = 0;
+        for (int d = 0; d < DIGITS; d ++) {
+            u32 c = counts[d];
+            counts[d] = total, total += c;
+        }
+        for (u32 i = 0; i < count; i ++) to[counts[bits[from[i]] >> shift & (DIGITS - 1)] ++] = from[i];
+        u32* t = from;
+        from = to, to = t;
+    }
+
+    // three passes leave the result in scratch
+    if (from != order.begin()) memcpy(order.begin(), from, count * sizeof(u32));
+}
\ No newline at end of file
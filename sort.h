@@ -0,0 +1,11 @@
+#ifndef _LIBDRAW_SORT_H
+#define _LIBDRAW_SORT_H
+
+#include "lib/util/defs.h"
+#include "lib/util/vec.h"
+
+// Fills order with the indices of keys, from the smallest key to the largest.
+// Equal keys keep their original order.
+void sortkeys(const float* keys, u32 count, vector<u32>& order);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,20 @@
+#include "stats.h"
+#include "string.h"
+#include "lib/GLFW/glfw3.h"
+
+FrameStats framecounts;
+static FrameStats last;
+
+// Milliseconds, from the same clock as seconds().
+double stats_clock() {
+    return glfwGetTime() * 1000;
+}
+
+void finish_stats() {
+    last = framecounts;
+    memset(&framecounts, 0, sizeof(framecounts));
+}
+
+extern "C" FrameStats LIBDRAW_SYMBOL(framestats)() {
+    return last;
+}
\ No newline at end of file
@@ -0,0 +1,13 @@
+#ifndef _LIBDRAW_STATS_H
+#define _LIBDRAW_STATS_H
+
+#include "draw.h"
+
+// Counts for the frame being drawn, added to by whatever sends work to the
+// GPU. framestats() reports those of the last finished frame.
+extern FrameStats framecounts;
+
+double stats_clock();
+void finish_stats();
+
+#endif
\ No newline at end of file
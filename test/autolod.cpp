@@ -0,0 +1,58 @@
+#include "draw.h"
+#include "math.h"
+#include "stdio.h"
+#include "stdlib.h"
+
+static float pi = 3.14159265358979323f;
+
+int main(int argc, char** argv) {
+    srand(0);
+    window(480, 320, "My Window");
+    float yaw = 0, pitch = 0;
+    float x = 0, y = 8, z = 24;
+    float pmx = 0, pmy = 0;
+
+    Image slab = image("asset/slab.png");
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+    bool automatic = true;
+    char stats[64];
+
+    while (running()) {
+        // camera controls
+        hidemouse();
+        pmx = (pmx + (mousex() - width(SCREEN) / 2) * 0.5f) / 5;
+        pmy = (pmy + (mousey() - height(SCREEN) / 2) * 0.5f) / 5;
+        yaw += pmx, pitch -= pmy;
+        setmouse(width(SCREEN) / 2, height(SCREEN) / 2);
+        if (pitch < -90) pitch = -90;
+        if (pitch > 90) pitch = 90;
+        if (keydown("w")) x -= sin(pi * -yaw / 180), z -= cos(pi * -yaw / 180);
+        if (keydown("s")) x += sin(pi * -yaw / 180), z += cos(pi * -yaw / 180);
+        if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
+        if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
+        if (keytap("1")) automatic = !automatic;
+
+        // set camera
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
+
+        // rows of round shapes stretching off into the distance, so the near
+        // ones are smooth and the far ones are cheap
+        autolod(automatic);
+        for (int i = 0; i < 64; i ++) {
+            sphere(-12, 8, -i * 24, 12, 12, 12, actex(slab));
+            cylinder(0, 6, -i * 24, 8, 12, 8, Y_AXIS, actex(slab));
+            cone(12, 6, -i * 24, 8, 12, 8, DIR_UP, actex(slab));
+        }
+        autolod(false);
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        origin(TOP_LEFT);
+        snprintf(stats, sizeof(stats), "automatic detail %s", automatic ? "on" : "off");
+        text(4, 4, stats);
+        origin(CENTER);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "draw.h"
+#include "math.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "time.h"
+
+static float pi = 3.14159265358979323f;
+static const int GRID = 48;
+
+struct Block {
+    float x, z, h, distance;
+};
+
+static int nearer(const void* a, const void* b) {
+    float da = ((const Block*)a)->distance, db = ((const Block*)b)->distance;
+    return da < db ? -1 : da > db;
+}
+
+int main(int argc, char** argv) {
+    srand(0);
+    window(480, 320, "My Window");
+    float yaw = 0, pitch = 0;
+    float x = 0, y = 6, z = 0;
+    float pmx = 0, pmy = 0;
+
+    // every building is the same unit cube, stretched into place
+    Image brick = image("asset/brick.png");
+    origin(FRONT_TOP_LEFT);
+    cube(-0.5f, 0, -0.5f, 1, 1, 1, actex(brick));
+    origin(CENTER);
+    Model building = sketch();
+
+    static Block blocks[GRID * GRID];
+    for (int i = 0; i < GRID; i ++) for (int j = 0; j < GRID; j ++) {
+        Block& b = blocks[i * GRID + j];
+        b.x = (i - GRID / 2) * 16, b.z = (j - GRID / 2) * 16;
+        b.h = 8 + rand() % 40;
+    }
+
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+    bool culling = true;
+    char stats[64];
+    clock_t last = clock();
+    float ms = 0;
+
+    while (running()) {
+        // camera controls
+        hidemouse();
+        pmx = (pmx + (mousex() - width(SCREEN) / 2) * 0.5f) / 5;
+        pmy = (pmy + (mousey() - height(SCREEN) / 2) * 0.5f) / 5;
+        yaw += pmx, pitch -= pmy;
+        setmouse(width(SCREEN) / 2, height(SCREEN) / 2);
+        if (pitch < -90) pitch = -90;
+        if (pitch > 90) pitch = 90;
+        if (keydown("w")) x -= sin(pi * -yaw / 180), z -= cos(pi * -yaw / 180);
+        if (keydown("s")) x += sin(pi * -yaw / 180), z += cos(pi * -yaw / 180);
+        if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
+        if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
+        if (keytap("1")) culling = !culling;
+        occluder(building, culling);
+
+        // set camera
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
+
+        // nearest buildings first, so they hide the most of what comes after
+        for (Block& b : blocks) b.distance = (b.x - x) * (b.x - x) + (b.z - z) * (b.z - z);
+        qsort(blocks, GRID * GRID, sizeof(Block), nearer);
+        for (const Block& b : blocks) {
+            beginstate();
+            translate(b.x, 0, b.z);
+            scale3d(10, b.h, 10);
+            render(building, brick);
+            endstate();
+        }
+
+        clock_t now = clock();
+        ms = ms * 0.9f + 100.0f * (now - last) / CLOCKS_PER_SEC;
+        last = now;
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        origin(TOP_LEFT);
+        snprintf(stats, sizeof(stats), "culling %s, %d hidden, %.1f ms", culling ? "on" : "off", occluded(), ms);
+        text(4, 4, stats);
+        origin(CENTER);
+    }
+    return 0;
+}
\ No newline at end of file
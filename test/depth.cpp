@@ -9,17 +9,17 @@ const char* DEPTH_FSH = R"(
     in vec4 v_col;
     in vec2 v_uv;
     in vec4 v_spr;
-    uniform int width, height;
-    uniform float near, far;
     uniform sampler2D tex;
     out vec4 color;
 
-    vec2 dims;
+    // the range used by frustum()
+    const float near = 0.125, far = 1000;
 
     void main() {
-        float depth = gl_FragCoord.z * 2 - 1;
+        vec2 uv = v_spr.xy + v_spr.zw * fract(v_uv);
+        float depth = texture(tex, uv).r * 2 - 1;
         depth = (2 * near * far) / (far + near - depth * (far - near));
-        
+
         color = vec4(vec3(depth / far * 4), 1);
     }
 )";
@@ -40,7 +40,8 @@ int main(int argc, char** argv) {
 
     Image fontimg = image("asset/font.png");
     Image bg = image("asset/sunset.png");
-    Image depthbuf = newimage(480, 320);
+    Image depthbuf = formatimage(480, 320, DEPTH_FORMAT);
+    Image linear = newimage(480, 320);
     Shader depth = shader(DEFAULT_VSH, DEPTH_FSH);
     font(fontimg);
     while (running()) {
@@ -74,13 +75,16 @@ int main(int argc, char** argv) {
         cube(0, 0, 8, 6, 6, 4, sctex(BLANK));
         color(WHITE);
 
-        shade(depthbuf, depth);
+        paint(depthbuf);
 
         ortho(width(SCREEN), height(SCREEN));
         snap(0, 0, 0);
+        sprite(width(SCREEN) / 2, height(SCREEN) / 2, depthbuf);
+        shade(linear, depth);
+
         // color(WHITE);
         rect(0, 0, width(SCREEN), height(SCREEN));
-        sprite(width(SCREEN) / 2, height(SCREEN) / 2, depthbuf);
+        sprite(width(SCREEN) / 2, height(SCREEN) / 2, linear);
     }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include "draw.h"
+#include "math.h"
+#include "stdio.h"
+
+int main(int argc, char** argv) {
+    window(480, 320, "My Window");
+
+    Image slab = image("asset/slab.png");
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+    char line[128];
+    float angle = 0;
+    PassTime passes[8];
+    gputimers(true);
+    tracefile("framestats.json");
+
+    while (running()) {
+        FrameStats stats = framestats();
+        int npasses = passtimes(passes, 8);
+        angle += 1;
+
+        // some cubes, alternating between two textures, so every one of them
+        // starts a new batch
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(0, 8, 24, 0, -15);
+        tracebegin("cubes");
+        for (int i = 0; i < 16; i ++) {
+            beginstate();
+            rotate(angle + i * 22.5f, Y_AXIS);
+            cube(12, 0, 0, 4, 4, 4, actex(i % 2 ? slab : BLANK));
+            endstate();
+        }
+        traceend();
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        origin(TOP_LEFT);
+        snprintf(line, sizeof(line), "%d draws, %d textures, %d shaders, %d targets",
+            stats.drawcalls, stats.texturebinds, stats.shaderbinds, stats.targetswitches);
+        text(4, 4, line);
+        snprintf(line, sizeof(line), "%lld vertices, %lld bytes uploaded", stats.vertices, stats.bytes);
+        text(4, 16, line);
+        snprintf(line, sizeof(line), "breaks: %d texture, %d mode, %d transform",
+            stats.breaks[TEXTURE_BREAK], stats.breaks[MODE_BREAK], stats.breaks[TRANSFORM_BREAK]);
+        text(4, 28, line);
+        snprintf(line, sizeof(line), "%.2f ms queueing, %.2f ms building, %.2f ms drawing",
+            stats.enqueuems, stats.tessellatems, stats.submitms);
+        text(4, 40, line);
+        for (int i = 0; i < npasses && i < 8; i ++) {
+            snprintf(line, sizeof(line), "%s: %.3f ms on the GPU", passes[i].name, passes[i].ms);
+            text(4, 56 + i * 12, line);
+        }
+        origin(CENTER);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "draw.h"
+#include "math.h"
+#include "stdio.h"
+
+static float pi = 3.14159265358979323f;
+
+static Model tree(Image img) {
+    origin(CENTER);
+    cylinder(0, 4, 0, 2, 8, 2, Y_AXIS, actex(img));
+    for (int i = 0; i < 4; i ++) cone(0, 10 + i * 4, 0, 12 - i * 2, 8, 12 - i * 2, DIR_UP, actex(img));
+    return sketch();
+}
+
+int main(int argc, char** argv) {
+    window(480, 320, "My Window");
+    float yaw = 0, pitch = 0;
+    float x = 0, y = 8, z = 24;
+    float pmx = 0, pmy = 0;
+
+    Image slab = image("asset/slab.png");
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+
+    // the same tree twice, one of them swapped for a picture of itself past
+    // a distance
+    Model full = tree(slab);
+    Model pictured = tree(slab);
+    impostor(pictured, slab, 16, 64);
+    bool impostors = true;
+    char stats[64];
+
+    while (running()) {
+        // camera controls
+        hidemouse();
+        pmx = (pmx + (mousex() - width(SCREEN) / 2) * 0.5f) / 5;
+        pmy = (pmy + (mousey() - height(SCREEN) / 2) * 0.5f) / 5;
+        yaw += pmx, pitch -= pmy;
+        setmouse(width(SCREEN) / 2, height(SCREEN) / 2);
+        if (pitch < -90) pitch = -90;
+        if (pitch > 90) pitch = 90;
+        if (keydown("w")) x -= sin(pi * -yaw / 180), z -= cos(pi * -yaw / 180);
+        if (keydown("s")) x += sin(pi * -yaw / 180), z += cos(pi * -yaw / 180);
+        if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
+        if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
+        if (keytap("1")) impostors = !impostors;
+
+        // set camera
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
+
+        // a forest, each tree turned a different way
+        for (int i = 0; i < 32; i ++) {
+            for (int j = 0; j < 32; j ++) {
+                beginstate();
+                rotate(i * 37 + j * 23, Y_AXIS);
+                translate((j - 16) * 16, 0, -i * 16);
+                render(impostors ? pictured : full, slab);
+                endstate();
+            }
+        }
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        origin(TOP_LEFT);
+        snprintf(stats, sizeof(stats), "impostors %s", impostors ? "on" : "off");
+        text(4, 4, stats);
+        origin(CENTER);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "draw.h"
+#include "math.h"
+#include "stdio.h"
+#include "stdlib.h"
+
+static float pi = 3.14159265358979323f;
+static const int GRID = 320, MOVERS = 256;
+
+static void placement(float matrix[16], float x, float y, float z, float size) {
+    for (int i = 0; i < 16; i ++) matrix[i] = 0;
+    matrix[0] = matrix[5] = matrix[10] = size, matrix[15] = 1;
+    matrix[12] = x, matrix[13] = y, matrix[14] = z;
+}
+
+int main(int argc, char** argv) {
+    srand(0);
+    window(480, 320, "My Window");
+    float yaw = 0, pitch = 0;
+    float x = 0, y = 16, z = 0;
+    float pmx = 0, pmy = 0;
+
+    // a small tree: a trunk with a block of leaves on top
+    Image bark = image("asset/brick.png");
+    origin(FRONT_TOP_LEFT);
+    cube(-1, 0, -1, 2, 6, 2, actex(bark));
+    color(GREEN);
+    cube(-3, 6, -3, 6, 6, 6, actex(bark));
+    color(WHITE);
+    origin(CENTER);
+    Model tree = sketch();
+
+    // a whole forest is placed once, and only the movers are touched again
+    float matrix[16];
+    for (int i = 0; i < GRID; i ++) for (int j = 0; j < GRID; j ++) {
+        float size = 0.75f + (rand() % 100) / 200.0f;
+        placement(matrix, (i - GRID / 2) * 10 + rand() % 5, 0, (j - GRID / 2) * 10 + rand() % 5, size);
+        placeinstance(tree, bark, matrix);
+    }
+    Instance movers[MOVERS];
+    for (int i = 0; i < MOVERS; i ++) movers[i] = placeinstance(tree, bark, matrix);
+
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+    char stats[64];
+
+    while (running()) {
+        // camera controls
+        hidemouse();
+        pmx = (pmx + (mousex() - width(SCREEN) / 2) * 0.5f) / 5;
+        pmy = (pmy + (mousey() - height(SCREEN) / 2) * 0.5f) / 5;
+        yaw += pmx, pitch -= pmy;
+        setmouse(width(SCREEN) / 2, height(SCREEN) / 2);
+        if (pitch < -90) pitch = -90;
+        if (pitch > 90) pitch = 90;
+        if (keydown("w")) x -= sin(pi * -yaw / 180), z -= cos(pi * -yaw / 180);
+        if (keydown("s")) x += sin(pi * -yaw / 180), z += cos(pi * -yaw / 180);
+        if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
+        if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
+
+        // movers circle around the camera's starting point
+        float t = seconds();
+        for (int i = 0; i < MOVERS; i ++) {
+            float a = t * 0.2f + i * 2 * pi / MOVERS, r = 60 + (i % 8) * 20;
+            placement(matrix, cos(a) * r, 20 + (i % 4) * 5, sin(a) * r, 0.5f);
+            moveinstance(movers[i], matrix);
+        }
+
+        // set camera
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
+        renderinstances();
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        origin(TOP_LEFT);
+        snprintf(stats, sizeof(stats), "%d trees, %d fps", GRID * GRID + MOVERS, (int)(frames() / (t > 0 ? t : 1)));
+        text(4, 4, stats);
+        origin(CENTER);
+    }
+    return 0;
+}
\ No newline at end of file
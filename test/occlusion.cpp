@@ -0,0 +1,71 @@
+#include "draw.h"
+#include "math.h"
+#include "stdio.h"
+#include "stdlib.h"
+
+static float pi = 3.14159265358979323f;
+
+int main(int argc, char** argv) {
+    srand(0);
+    window(480, 320, "My Window");
+    float yaw = 0, pitch = 0;
+    float x = 0, y = 8, z = 120;
+    float pmx = 0, pmy = 0;
+
+    Image brick = image("asset/brick.png");
+    Image slab = image("asset/slab.png");
+    origin(FRONT_TOP_LEFT);
+    for (int i = 0; i < 8; i ++) cube(-4, i * 8, -4, 8, 8, 8, actex(brick));
+    origin(CENTER);
+    Model tower = sketch();
+
+    // a long wall between the camera and the towers
+    origin(FRONT_TOP_LEFT);
+    cube(-128, 0, 100, 256, 48, 4, actex(slab));
+    origin(CENTER);
+    Model wall = sketch();
+
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+    bool testing = true;
+    char stats[64];
+
+    while (running()) {
+        // camera controls
+        hidemouse();
+        pmx = (pmx + (mousex() - width(SCREEN) / 2) * 0.5f) / 5;
+        pmy = (pmy + (mousey() - height(SCREEN) / 2) * 0.5f) / 5;
+        yaw += pmx, pitch -= pmy;
+        setmouse(width(SCREEN) / 2, height(SCREEN) / 2);
+        if (pitch < -90) pitch = -90;
+        if (pitch > 90) pitch = 90;
+        if (keydown("w")) x -= sin(pi * -yaw / 180), z -= cos(pi * -yaw / 180);
+        if (keydown("s")) x += sin(pi * -yaw / 180), z += cos(pi * -yaw / 180);
+        if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
+        if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
+        if (keytap("1")) testing = !testing;
+
+        // set camera
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
+
+        // the wall is drawn first, so it's in the depth buffer for the queries
+        render(wall, slab);
+        occlusion(testing);
+        for (int i = 0; i < 16; i ++) for (int j = 0; j < 16; j ++) {
+            beginstate();
+            translate((i - 8) * 12, 0, (j - 8) * 12);
+            render(tower, brick);
+            endstate();
+        }
+        occlusion(false);
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        origin(TOP_LEFT);
+        snprintf(stats, sizeof(stats), "occlusion %s, %d hidden", testing ? "on" : "off", occluded());
+        text(4, 4, stats);
+        origin(CENTER);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "draw.h"
+#include "math.h"
+#include "stdio.h"
+#include "stdlib.h"
+
+static float pi = 3.14159265358979323f;
+
+int main(int argc, char** argv) {
+    srand(0);
+    window(480, 320, "My Window");
+    float yaw = 0, pitch = 0;
+    float x = 0, y = 8, z = 96;
+    float pmx = 0, pmy = 0;
+
+    // a tower of stacked blocks, drawn many times over
+    Image brick = image("asset/brick.png");
+    origin(FRONT_TOP_LEFT);
+    for (int i = 0; i < 8; i ++) cube(-4 + i % 2, i * 8, -4 + i % 2, 8, 8, 8, actex(brick));
+    origin(CENTER);
+    Model tower = sketch();
+
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+    bool sorting = true, prepass = false;
+    char stats[64];
+    measureoverdraw(true);
+
+    while (running()) {
+        // camera controls
+        hidemouse();
+        pmx = (pmx + (mousex() - width(SCREEN) / 2) * 0.5f) / 5;
+        pmy = (pmy + (mousey() - height(SCREEN) / 2) * 0.5f) / 5;
+        yaw += pmx, pitch -= pmy;
+        setmouse(width(SCREEN) / 2, height(SCREEN) / 2);
+        if (pitch < -90) pitch = -90;
+        if (pitch > 90) pitch = 90;
+        if (keydown("w")) x -= sin(pi * -yaw / 180), z -= cos(pi * -yaw / 180);
+        if (keydown("s")) x += sin(pi * -yaw / 180), z += cos(pi * -yaw / 180);
+        if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
+        if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
+
+        // 1 toggles sorting, 2 toggles the depth prepass
+        if (keytap("1")) sorting = !sorting;
+        if (keytap("2")) prepass = !prepass;
+
+        // set camera
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
+
+        // draw the towers back to front, the worst case without sorting
+        depthsort(sorting, prepass);
+        for (int i = 15; i >= 0; i --) for (int j = 15; j >= 0; j --) {
+            beginstate();
+            translate((i - 8) * 12, 0, (j - 8) * 12);
+            render(tower, brick);
+            endstate();
+        }
+        depthsort(false, false);
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        origin(TOP_LEFT);
+        snprintf(stats, sizeof(stats), "sort %s, prepass %s, overdraw %.2f", sorting ? "on" : "off", prepass ? "on" : "off", overdraw());
+        text(4, 4, stats);
+        origin(CENTER);
+    }
+    return 0;
+}
\ No newline at end of file
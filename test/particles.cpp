@@ -0,0 +1,33 @@
+#include "draw.h"
+#include "stdlib.h"
+
+int main(int argc, char** argv) {
+    srand(0);
+    window(240, 160, "My Window");
+
+    Image block = image("asset/block.png");
+    Image smile = image("asset/smile.png");
+    Emitter fountain = emitter(20000, smile);
+    gravity(fountain, 0, -48, 0);
+
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+    while (running()) {
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(0, 48, 128, 0, -20);
+
+        origin(CENTER);
+        cube(0, -4, 0, 128, 8, 128, actex(block));
+
+        // a few hundred new particles a frame, with no per-particle work here
+        color(YELLOW);
+        emit(fountain, 200, 0, 0, 0, 0, 64, 0, 24, 2.5f);
+        color(WHITE);
+        particles(fountain);
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        text(8, 8, "20000 particles");
+    }
+    return 0;
+}
\ No newline at end of file
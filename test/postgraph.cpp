@@ -0,0 +1,104 @@
+#include "draw.h"
+#include "math.h"
+#include "stdlib.h"
+
+static float pi = 3.14159265358979323f;
+
+const char* BLUR_FSH = R"(
+    #version 330
+    uniform int width, height;
+    uniform sampler2D tex;
+    out vec4 color;
+
+    void main() {
+        vec2 dims = vec2(width, height);
+        color = vec4(0);
+        for (int i = -1; i < 2; i ++) for (int j = -1; j < 2; j ++)
+            color += texture(tex, (gl_FragCoord.xy + vec2(i, j)) / dims);
+        color /= 9.0;
+    }
+)";
+
+const char* OUTLINE_FSH = R"(
+    #version 330
+    uniform int width, height;
+    uniform sampler2D tex;
+    out vec4 color;
+
+    void main() {
+        vec2 dims = vec2(width, height);
+        vec4 col = texture(tex, gl_FragCoord.xy / dims);
+        float edge = 0;
+        for (int i = -1; i < 2; i += 2) {
+            edge += abs(texture(tex, (gl_FragCoord.xy + vec2(i, 0)) / dims).a - col.a);
+            edge += abs(texture(tex, (gl_FragCoord.xy + vec2(0, i)) / dims).a - col.a);
+        }
+        color = edge > 0.5 ? vec4(0, 0, 0, 1) : col;
+    }
+)";
+
+int main(int argc, char** argv) {
+    srand(0);
+    window(480, 320, "My Window");
+    float yaw = 0, pitch = 0;
+    float x = 0, y = 8, z = 0;
+    float pmx = 0, pmy = 0;
+
+    Image block = image("asset/block.png");
+    origin(FRONT_TOP_LEFT);
+    cube(-64, -16, -64, 128, 16, 128, actex(block));
+
+    origin(CENTER);
+    Model world = sketch();
+
+    Image bg = image("asset/sunset.png");
+
+    // blur -> outline -> sepia -> vignette. The last two are merged into a
+    // single pass when the graph is compiled.
+    PostGraph post = postgraph();
+    int blurred = postpass(post, shader(DEFAULT_VSH, BLUR_FSH), POST_SOURCE, RGBA8_FORMAT, 1);
+    int outlined = postpass(post, shader(DEFAULT_VSH, OUTLINE_FSH), blurred, RGBA8_FORMAT, 1);
+    int sepia = postpixel(post, R"(
+        float l = dot(color.rgb, vec3(0.3, 0.59, 0.11));
+        return vec4(l * vec3(1.2, 1.0, 0.8), color.a);
+    )", outlined, RGBA8_FORMAT);
+    postpixel(post, R"(
+        vec2 d = gl_FragCoord.xy / vec2(width, height) - 0.5;
+        return vec4(color.rgb * (1 - dot(d, d)), color.a);
+    )", sepia, RGBA8_FORMAT);
+    compilepost(post);
+
+    while (running()) {
+        Image rendered = target(480, 320, RGBA8_FORMAT, true);
+        origin(CENTER);
+
+        // camera controls
+        hidemouse();
+        pmx = (pmx + (mousex() - width(SCREEN) / 2) * 0.5f) / 5;
+        pmy = (pmy + (mousey() - height(SCREEN) / 2) * 0.5f) / 5;
+        yaw += pmx, pitch -= pmy;
+        setmouse(width(SCREEN) / 2, height(SCREEN) / 2);
+        if (pitch < -90) pitch = -90;
+        if (pitch > 90) pitch = 90;
+        if (keydown("w")) x -= sin(pi * -yaw / 180), z -= cos(pi * -yaw / 180);
+        if (keydown("s")) x += sin(pi * -yaw / 180), z += cos(pi * -yaw / 180);
+        if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
+        if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
+
+        // set camera
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
+
+        // draw scene
+        render(world, block);
+        paint(rendered);
+
+        Image result = runpost(post, rendered);
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        sprite(width(SCREEN) / 2, height(SCREEN) / 2, bg);
+        sprite(width(SCREEN) / 2, height(SCREEN) / 2, result);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -4,54 +4,6 @@
 
 static float pi = 3.14159265358979323f;
 
-const char* LIGHT_FSH = R"(
-    #version 330
-    in vec4 v_pos;
-    in vec4 v_col;
-    in vec2 v_uv;
-    in vec4 v_spr;
-    uniform int width, height;
-    uniform sampler2D tex;
-    uniform vec4 fog_color;
-    uniform float fog_range;
-    out vec4 color;
-
-    struct Light {
-        vec4 color;
-        vec3 pos;
-        float radius;
-    };
-    uniform Light lights[2];
-    uniform float ambient;
-    const int N_LIGHTS = 2;
-
-    void main() {
-        // This bit is straight from DEFAULT_FSH
-        if (color.a <= 0.00390625) discard;
-        vec2 fract_uv = fract(v_uv);
-        vec2 fixed_uv = vec2(v_spr.x + v_spr.z * fract_uv.x, v_spr.y + v_spr.w * fract_uv.y);
-        color = v_col * texture2D(tex, fixed_uv);
-
-        // This bit handles the dynamic lighting.
-        color.rgb *= ambient; // Ambient base.
-        vec4 lit = vec4(0);
-        for (int i = 0; i < N_LIGHTS; i ++) {
-            float dist = sqrt(dot(v_pos.xyz - lights[i].pos, v_pos.xyz - lights[i].pos));
-            float bright = clamp(1.0 - dist / lights[i].radius, 0, 1);
-            bright *= bright;
-            lit.rgb += lights[i].color.rgb * bright * lights[i].color.a;
-        }
-        color = clamp(lit + color, 0, 1);
-
-        // Fog handled after.
-        if (fog_range > 0.01) {
-            float v_dist = sqrt(v_pos.x * v_pos.x + v_pos.y * v_pos.y + v_pos.z * v_pos.z);
-            float fog_density = clamp((fog_range - v_dist) / fog_range, 0, 1);
-            color = vec4(mix(fog_color.rgb, color.rgb, fog_density), color.a);
-        }
-    }
-)";
-
 int main(int argc, char** argv) {
     srand(32);
     window(480, 320, "My Window");
@@ -69,17 +21,17 @@ int main(int argc, char** argv) {
     Model world = sketch();
 
     Image fontimg = image("asset/font.png");
-    Image lightbuf = newimage(width(SCREEN), height(SCREEN)), renderbuf = newimage(width(SCREEN), height(SCREEN));
     font(fontimg);
 
-    Shader lightshdr = shader(DEFAULT_VSH, LIGHT_FSH);
-    uniformv4(lightshdr, "lights[0].color", 1, 0.25f, 0.125f, 1);
-    uniformv3(lightshdr, "lights[0].pos", -48, 0, -48);
-    uniformf(lightshdr, "lights[0].radius", 48);
-    uniformv4(lightshdr, "lights[1].color", 0.25f, 0.5f, 1, 2);
-    uniformv3(lightshdr, "lights[1].pos", 0, 0, 32);
-    uniformf(lightshdr, "lights[1].radius", 96);
-    uniformf(lightshdr, "ambient", 0.75f);
+    // a few hundred lights, each drifting in a small circle
+    const int N_LIGHTS = 256;
+    float lx[N_LIGHTS], lz[N_LIGHTS], phase[N_LIGHTS];
+    Color lcol[N_LIGHTS];
+    for (int i = 0; i < N_LIGHTS; i ++) {
+        lx[i] = rand() % 128 - 64, lz[i] = rand() % 128 - 64;
+        phase[i] = rand() % 360 * pi / 180;
+        lcol[i] = rgba(rand() % 256, rand() % 256, rand() % 256, 192);
+    }
 
     while (running()) {
         origin(CENTER);
@@ -103,16 +55,13 @@ int main(int argc, char** argv) {
         frustum(width(SCREEN), height(SCREEN), 70);
         look(x, y, z, yaw, pitch);
 
+        // add lights
+        float t = frames() / 60.0f;
+        for (int i = 0; i < N_LIGHTS; i ++)
+            pointlight(lx[i] + 8 * cos(t + phase[i]), 4, lz[i] + 8 * sin(t + phase[i]), 16, lcol[i]);
+
         // draw scene
         render(world, brick);
-
-        // render to texture through custom shader
-        shade(lightbuf, lightshdr);
-        
-        // draw renderbuffer to screen
-        ortho(width(SCREEN), height(SCREEN));
-        look(0, 0, 0, 0, 0); // reset camera
-        sprite(width(SCREEN) / 2, height(SCREEN) / 2, lightbuf);
     }
     return 0;
 }
\ No newline at end of file
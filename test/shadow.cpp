@@ -4,27 +4,6 @@
 
 static float pi = 3.14159265358979323f;
 
-const char* DEPTH_FSH = R"(
-    #version 330
-    in vec4 v_col;
-    in vec2 v_uv;
-    in vec4 v_spr;
-    uniform int width, height;
-    uniform float near, far;
-    uniform sampler2D tex;
-    out vec4 color;
-
-    vec2 dims;
-
-    void main() {
-        float depth = gl_FragCoord.z;
-        depth -= 0.5;
-        depth *= 10; 
-        depth += 0.5;
-        color = vec4(fract(depth * 256), depth - fract(depth * 256), 0, 1);
-    }
-)";
-
 int main(int argc, char** argv) {
     srand(0);
     window(480, 320, "My Window");
@@ -41,8 +20,7 @@ int main(int argc, char** argv) {
 
     Image fontimg = image("asset/font.png");
     Image bg = image("asset/sunset.png");
-    Image depthbuf = newimage(960, 640);
-    Shader depth = shader(DEFAULT_VSH, DEPTH_FSH);
+    Image depthbuf = formatimage(2048, 2048, DEPTH_FORMAT);
     font(fontimg);
     while (running()) {
         origin(CENTER);
@@ -60,10 +38,20 @@ int main(int argc, char** argv) {
         if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
         if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
 
+        // draw shadow casters from the light
+        render(world, block);
+        color(RED);
+        cube(0, 0, 0, 16, 4, 4, sctex(BLANK));
+        cube(8, 0, 0, 4, 6, 6, sctex(BLANK));
+        color(BLUE);
+        cube(0, 0, 0, 4, 4, 16, sctex(BLANK));
+        cube(0, 0, 8, 6, 6, 4, sctex(BLANK));
+        color(WHITE);
+        shadowmap(depthbuf, x, 0, z, 96);
+
         // set camera
-        ortho(width(SCREEN), height(SCREEN));
-        lookat(0, 0, 0, lightdirx(), lightdiry(), lightdirz());
-        pan(width(SCREEN) / 2, height(SCREEN) / 2, 0);
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
 
         // draw scene
         render(world, block);
@@ -76,13 +64,15 @@ int main(int argc, char** argv) {
         cube(0, 0, 8, 6, 6, 4, sctex(BLANK));
         color(WHITE);
 
-        shade(depthbuf, depth);
-
+        // show the shadow map in a corner
+        noshadows();
         ortho(width(SCREEN), height(SCREEN));
         snap(0, 0, 0);
-        // color(WHITE);
-        rect(0, 0, width(SCREEN), height(SCREEN));
-        sprite(width(SCREEN) / 2, height(SCREEN) / 2, depthbuf);
+        origin(TOP_LEFT);
+        beginstate();
+        scale(0.0625f);
+        sprite(0, 0, depthbuf);
+        endstate();
     }
     return 0;
 }
\ No newline at end of file
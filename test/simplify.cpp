@@ -0,0 +1,64 @@
+#include "draw.h"
+#include "math.h"
+#include "stdio.h"
+
+static float pi = 3.14159265358979323f;
+
+int main(int argc, char** argv) {
+    window(480, 320, "My Window");
+    float yaw = 0, pitch = 0;
+    float x = 0, y = 8, z = 24;
+    float pmx = 0, pmy = 0;
+
+    Image slab = image("asset/slab.png");
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+
+    // a single very detailed ball, once as it is and once with simpler
+    // versions of itself to draw from afar
+    hedron(0, 0, 0, 12, 12, 12, 256, 128, actex(slab));
+    Model full = sketch();
+    hedron(0, 0, 0, 12, 12, 12, 256, 128, actex(slab));
+    Model chained = sketch();
+    lodmodel(chained, 6);
+    bool simplified = true;
+    char stats[64];
+
+    while (running()) {
+        // camera controls
+        hidemouse();
+        pmx = (pmx + (mousex() - width(SCREEN) / 2) * 0.5f) / 5;
+        pmy = (pmy + (mousey() - height(SCREEN) / 2) * 0.5f) / 5;
+        yaw += pmx, pitch -= pmy;
+        setmouse(width(SCREEN) / 2, height(SCREEN) / 2);
+        if (pitch < -90) pitch = -90;
+        if (pitch > 90) pitch = 90;
+        if (keydown("w")) x -= sin(pi * -yaw / 180), z -= cos(pi * -yaw / 180);
+        if (keydown("s")) x += sin(pi * -yaw / 180), z += cos(pi * -yaw / 180);
+        if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
+        if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
+        if (keytap("1")) simplified = !simplified;
+
+        // set camera
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
+
+        // rows of balls stretching off into the distance
+        for (int i = 0; i < 32; i ++) {
+            for (int j = -2; j <= 2; j ++) {
+                beginstate();
+                translate(j * 16, 8, -i * 16);
+                render(simplified ? chained : full, slab);
+                endstate();
+            }
+        }
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+        origin(TOP_LEFT);
+        snprintf(stats, sizeof(stats), "simplified models %s", simplified ? "on" : "off");
+        text(4, 4, stats);
+        origin(CENTER);
+    }
+    return 0;
+}
\ No newline at end of file
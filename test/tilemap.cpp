@@ -0,0 +1,38 @@
+#include "draw.h"
+#include "math.h"
+#include "stdlib.h"
+
+int main(int argc, char** argv) {
+    srand(0);
+    window(480, 320, "My Window");
+
+    const int cols = 4096, rows = 4096;
+    Image sheet = image("asset/cavern_sheet.png");
+    int* tiles = new int[cols * rows];
+    for (int i = 0; i < cols * rows; i ++) tiles[i] = rand() % 8 == 0 ? -1 : rand() % 256;
+    Tilemap map = tilemap(sheet, tiles, cols, rows, 16, 16);
+    delete[] tiles;
+
+    Image fontimg = image("asset/font.png");
+    font(fontimg);
+    float x = 0, y = 0;
+    while (running()) {
+        if (keydown("w")) y -= 4;
+        if (keydown("s")) y += 4;
+        if (keydown("a")) x -= 4;
+        if (keydown("d")) x += 4;
+
+        // change a tile under the mouse
+        if (mousedown(LEFT_CLICK)) {
+            int tx = int(mousex() + x) / 16, ty = int(mousey() + y) / 16, empty = -1;
+            if (tx >= 0 && ty >= 0 && tx < cols && ty < rows) settiles(map, tx, ty, 1, 1, &empty);
+        }
+
+        look(x, y, 0, 0, 0);
+        drawtiles(map, 0, 0);
+
+        look(0, 0, 0, 0, 0);
+        text(8, 8, "WASD to scroll, click to erase");
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "draw.h"
+#include "math.h"
+#include "stdlib.h"
+
+static float pi = 3.14159265358979323f;
+
+int main(int argc, char** argv) {
+    srand(0);
+    window(480, 320, "My Window");
+    float yaw = 0, pitch = 0;
+    float x = 0, y = 8, z = 48;
+    float pmx = 0, pmy = 0;
+
+    Image block = image("asset/block.png");
+    Image smile = image("asset/smile.png");
+    origin(FRONT_TOP_LEFT);
+    cube(-64, -16, -64, 128, 16, 128, actex(block));
+    origin(CENTER);
+    Model world = sketch();
+
+    Color glass[4] = { rgba(255, 64, 64, 96), rgba(64, 255, 64, 96), rgba(64, 64, 255, 96), rgba(255, 255, 64, 96) };
+
+    while (running()) {
+        // camera controls
+        hidemouse();
+        pmx = (pmx + (mousex() - width(SCREEN) / 2) * 0.5f) / 5;
+        pmy = (pmy + (mousey() - height(SCREEN) / 2) * 0.5f) / 5;
+        yaw += pmx, pitch -= pmy;
+        setmouse(width(SCREEN) / 2, height(SCREEN) / 2);
+        if (pitch < -90) pitch = -90;
+        if (pitch > 90) pitch = 90;
+        if (keydown("w")) x -= sin(pi * -yaw / 180), z -= cos(pi * -yaw / 180);
+        if (keydown("s")) x += sin(pi * -yaw / 180), z += cos(pi * -yaw / 180);
+        if (keydown("a")) x -= sin(pi * (90 + yaw) / 180), z += cos(pi * (90 + yaw) / 180);
+        if (keydown("d")) x += sin(pi * (90 + yaw) / 180), z -= cos(pi * (90 + yaw) / 180);
+
+        // set camera
+        frustum(width(SCREEN), height(SCREEN), 70);
+        look(x, y, z, yaw, pitch);
+
+        // draw scene, with glass cubes submitted in no particular order
+        render(world, block);
+        for (int i = 0; i < 16; i ++) {
+            color(glass[i % 4]);
+            cube((i * 37 % 16 - 8) * 6, 6, (i * 11 % 16 - 8) * 6, 8, 8, 8, sctex(BLANK));
+        }
+        color(WHITE);
+
+        // boards with see-through textures have to be marked
+        translucent(true);
+        for (int i = 0; i < 8; i ++) board((i - 4) * 10, 16, -i * 6, smile);
+        translucent(false);
+
+        ortho(width(SCREEN), height(SCREEN));
+        snap(0, 0, 0);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "tilemap.h"
+#include "image.h"
+#include "shader.h"
+#include "lib/util/vec.h"
+#include "lib/util/io.h"
+
+static vector<TilemapMeta> maps;
+static Shader tileshader;
+
+// Renders a whole map as a single quad. The quad's UVs are in tile units, so
+// the integer part picks a cell of the index texture and the fractional part
+// is the position within that tile on the sheet.
+static const char* TILEMAP_FSH = R"(
+    #version 330
+    in vec4 v_col;
+    in vec2 v_uv;
+    in vec4 v_spr;
+    in vec4 v_pos;
+
+    uniform sampler2D tex;
+    uniform isampler2D tiles;
+    uniform ivec2 sheet_tiles;
+    uniform ivec2 map_size;
+
+    out vec4 color;
+
+    void main() {
+        ivec2 cell = ivec2(floor(v_uv));
+        if (cell.x < 0 || cell.y < 0 || cell.x >= map_size.x || cell.y >= map_size.y) discard;
+        int index = texelFetch(tiles, cell, 0).r;
+        if (index < 0 || index >= sheet_tiles.x * sheet_tiles.y) discard;
+        vec2 tile = vec2(index % sheet_tiles.x, index / sheet_tiles.x);
+        vec2 local = (tile + fract(v_uv)) / vec2(sheet_tiles);
+        color = v_col * texture(tex, v_spr.xy + v_spr.zw * local);
+        if (color.a <= 0.00390625) discard;
+    }
+)";
+
+TilemapMeta& findmap(Tilemap map) {
+    return maps[map];
+}
+
+Shader tilemap_shader() {
+    return tileshader;
+}
+
+void init_tilemaps() {
+    tileshader = shader(LIBDRAW_CONST(DEFAULT_VSH), TILEMAP_FSH);
+}
+
+// Indices are stored as 16-bit integers, so anything past the largest one is
+// left empty rather than wrapping around to some other tile. stride is the
+// width of a row of tiles, which may be wider than the region uploaded.
+static const int MAX_TILE_INDEX = 32767;
+
+static void upload(TilemapMeta& meta, int x, int y, int w, int h, const int* tiles, int stride) {
+    short* data = new short[w * h];
+    bool overflow = false;
+    for (int j = 0; j < h; j ++) for (int i = 0; i < w; i ++) {
+        int index = tiles ? tiles[j * stride + i] : -1;
+        if (index > MAX_TILE_INDEX) overflow = true, index = -1;
+        data[j * w + i] = index < 0 ? -1 : index;
+    }
+    if (overflow) println("Tile indices above ", MAX_TILE_INDEX, " are left empty!");
+
+    glBindTexture(GL_TEXTURE_2D, meta.tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RED_INTEGER, GL_SHORT, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    delete[] data;
+}
+
+extern "C" Tilemap LIBDRAW_SYMBOL(tilemap)(Image sheet, const int* tiles, int cols, int rows, int tilew, int tileh) {
+    // the index texture has a texel per tile, so a map can't be any bigger
+    // than the largest texture the driver allows
+    GLint maxsize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxsize);
+    int stride = cols;
+    if (cols > maxsize || rows > maxsize) {
+        println("Tilemap is larger than the largest texture (", maxsize, "), and was cut down to fit!");
+        if (cols > maxsize) cols = maxsize;
+        if (rows > maxsize) rows = maxsize;
+    }
+
+    GLuint id;
+    glGenTextures(1, &id);
+
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16I, cols, rows, 0, GL_RED_INTEGER, GL_SHORT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (GLenum err = glGetError()) println("Failed to create tilemap texture: ", (int)err);
+
+    maps.push({ sheet, id, cols, rows, tilew, tileh });
+    upload(maps.back(), 0, 0, cols, rows, tiles, stride);
+    return maps.size() - 1;
+}
+
+extern "C" void LIBDRAW_SYMBOL(settiles)(Tilemap map, int x, int y, int cols, int rows, const int* tiles) {
+    TilemapMeta& meta = findmap(map);
+    if (x < 0 || y < 0 || x + cols > meta.cols || y + rows > meta.rows) {
+        println("Tried to set tiles outside of tilemap bounds!");
+        return;
+    }
+    upload(meta, x, y, cols, rows, tiles, cols);
+}
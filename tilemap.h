@@ -0,0 +1,17 @@
+#ifndef _LIBDRAW_TILEMAP_H
+#define _LIBDRAW_TILEMAP_H
+
+#include "draw.h"
+#include "lib/GLAD/glad.h"
+
+struct TilemapMeta {
+    Image sheet;
+    GLuint tex;
+    int cols, rows, tilew, tileh;
+};
+
+TilemapMeta& findmap(Tilemap map);
+Shader tilemap_shader();
+void init_tilemaps();
+
+#endif
@@ -0,0 +1,66 @@
+#include "timer.h"
+#include "lib/GLAD/glad.h"
+#include "lib/util/vec.h"
+
+// Queries are read back several frames after they're issued, by which time
+// the GPU has normally finished with them, so reading them never waits. A
+// frame whose queries still aren't done by the time its slot comes around
+// again is dropped instead.
+static const int TIMER_FRAMES = 4;
+
+struct PendingTime {
+    GLuint query;
+    const char* name;
+};
+
+static bool timing = false, measuring = false;
+static int depth = 0;
+static vector<PendingTime> pending[TIMER_FRAMES];
+static vector<GLuint> freetimers;
+static vector<PassTime> latest;
+static u32 slot = 0;
+
+void begin_timer(const char* name) {
+    if (depth ++ || !timing) return;
+    GLuint query;
+    if (freetimers.size()) query = freetimers.back(), freetimers.pop();
+    else glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    pending[slot].push({ query, name });
+    measuring = true;
+}
+
+void end_timer() {
+    if (!depth || -- depth || !measuring) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    measuring = false;
+}
+
+void finish_timers() {
+    slot = (slot + 1) % TIMER_FRAMES;
+    vector<PendingTime>& oldest = pending[slot];
+    if (!oldest.size()) return;
+
+    GLint ready = 0;
+    glGetQueryObjectiv(oldest.back().query, GL_QUERY_RESULT_AVAILABLE, &ready);
+    if (ready) {
+        latest.clear();
+        for (const PendingTime& p : oldest) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(p.query, GL_QUERY_RESULT, &ns);
+            latest.push({ p.name, ns / 1000000.0 });
+        }
+    }
+    for (const PendingTime& p : oldest) freetimers.push(p.query);
+    oldest.clear();
+}
+
+extern "C" void LIBDRAW_SYMBOL(gputimers)(bool enabled) {
+    timing = enabled;
+}
+
+extern "C" int LIBDRAW_SYMBOL(passtimes)(PassTime* times, int max) {
+    int n = latest.size();
+    for (int i = 0; i < n && i < max; i ++) times[i] = latest[i];
+    return n;
+}
\ No newline at end of file
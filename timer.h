@@ -0,0 +1,13 @@
+#ifndef _LIBDRAW_TIMER_H
+#define _LIBDRAW_TIMER_H
+
+#include "draw.h"
+
+// Measures how long the GPU spends on the work sent between begin_timer()
+// and end_timer(), while gputimers() is enabled. Timers started while one is
+// already running are folded into it.
+void begin_timer(const char* name);
+void end_timer();
+void finish_timers();
+
+#endif
\ No newline at end of file
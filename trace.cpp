@@ -0,0 +1,166 @@
+#include "trace.h"
+#include "stdio.h"
+#include "string.h"
+#include "lib/GLFW/glfw3.h"
+#include "lib/util/vec.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Each thread records into a buffer of its own, without locking. Full buffers,
+// and the drawing thread's at the end of each frame, are handed to a writer
+// thread, which does all the formatting and file I/O, so tracing never waits
+// on the disk. The file is a Chrome trace event array, which chrome://tracing
+// and Perfetto both open.
+static const int TRACE_EVENTS = 8192;
+static const int TRACE_NAME = 48;
+
+struct TraceEvent {
+    char name[TRACE_NAME];
+    bool begin;
+    double us;
+};
+
+struct TraceBuffer {
+    TraceEvent events[TRACE_EVENTS];
+    int count, tid;
+};
+
+static FILE* tracing = nullptr;
+static std::atomic<bool> active(false);
+static std::atomic<int> generation(0), nexttid(0);
+static std::mutex lock;
+static std::condition_variable wake;
+static std::thread writer;
+static bool stopping = false, first = true;
+static vector<TraceBuffer*> full, spare, live;
+
+// A thread's buffer is dropped once the trace it was taken for is closed.
+static thread_local TraceBuffer* current = nullptr;
+static thread_local int currentgen = -1, tid = 0;
+
+static void writename(const char* name) {
+    for (const char* c = name; *c; c ++) {
+        if (*c == '"' || *c == '\\') fputc('\\', tracing), fputc(*c, tracing);
+        else if ((unsigned char)*c >= ' ') fputc(*c, tracing);
+    }
+}
+
+static void writebuffer(const TraceBuffer& buf) {
+    for (int i = 0; i < buf.count; i ++) {
+        const TraceEvent& e = buf.events[i];
+        fputs(first ? "\n" : ",\n", tracing);
+        first = false;
+        fputs("{\"name\":\"", tracing);
+        writename(e.name);
+        fprintf(tracing, "\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", e.begin ? 'B' : 'E', e.us, buf.tid);
+    }
+}
+
+static void writeloop() {
+    vector<TraceBuffer*> batch;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        while (!stopping && full.size() == 0) wake.wait(guard);
+        if (full.size() == 0) return;
+        batch.clear();
+        for (TraceBuffer* buf : full) batch.push(buf);
+        full.clear();
+        guard.unlock();
+        for (TraceBuffer* buf : batch) writebuffer(*buf);
+        guard.lock();
+        for (TraceBuffer* buf : batch) spare.push(buf);
+    }
+}
+
+static TraceBuffer* takebuffer() {
+    if (!tid) tid = ++ nexttid;
+    std::lock_guard<std::mutex> guard(lock);
+    TraceBuffer* buf = spare.size() ? spare.back() : new TraceBuffer;
+    if (spare.size()) spare.pop();
+    buf->count = 0, buf->tid = tid;
+    live.push(buf);
+    return buf;
+}
+
+// Called with the lock held.
+static void retire(TraceBuffer* buf) {
+    for (u32 i = 0; i < live.size(); i ++) if (live[i] == buf) {
+        live[i] = live.back(), live.pop();
+        break;
+    }
+    if (buf->count) full.push(buf);
+    else spare.push(buf);
+}
+
+static void handoff(TraceBuffer* buf) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        retire(buf);
+    }
+    wake.notify_one();
+}
+
+static void record(const char* name, bool begin) {
+    int gen = generation;
+    if (currentgen != gen) current = nullptr, currentgen = gen;
+    if (current && current->count == TRACE_EVENTS) handoff(current), current = nullptr;
+    if (!current) current = takebuffer();
+    TraceEvent& e = current->events[current->count ++];
+    strncpy(e.name, name, TRACE_NAME - 1);
+    e.name[TRACE_NAME - 1] = '\0';
+    e.begin = begin;
+    e.us = glfwGetTime() * 1000000;
+}
+
+void trace_begin(const char* name) {
+    if (active) record(name, true);
+}
+
+void trace_end() {
+    if (active) record("", false);
+}
+
+// Hands the frame's events to the writer, so they reach the file even if the
+// program stops without closing the trace.
+void finish_trace() {
+    if (!active || currentgen != generation || !current || !current->count) return;
+    handoff(current);
+    current = nullptr;
+}
+
+// Whatever other threads have recorded is written out too, so they shouldn't
+// be in the middle of recording when the trace is closed.
+extern "C" void LIBDRAW_SYMBOL(tracefile)(const char* path) {
+    if (tracing) {
+        active = false;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            while (live.size()) retire(live.back());
+            generation ++;
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        fputs("\n]\n", tracing);
+        fclose(tracing);
+        tracing = nullptr;
+    }
+    if (!path) return;
+    tracing = fopen(path, "w");
+    if (!tracing) return;
+    fputs("[", tracing);
+    first = true, stopping = false;
+    generation ++;
+    writer = std::thread(writeloop);
+    active = true;
+}
+
+extern "C" void LIBDRAW_SYMBOL(tracebegin)(const char* name) {
+    trace_begin(name);
+}
+
+extern "C" void LIBDRAW_SYMBOL(traceend)() {
+    trace_end();
+}
\ No newline at end of file
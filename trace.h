@@ -0,0 +1,13 @@
+#ifndef _LIBDRAW_TRACE_H
+#define _LIBDRAW_TRACE_H
+
+#include "draw.h"
+
+// Marks the start and end of a span on the timeline written by tracefile().
+// Spans nest, and each trace_end() closes the latest one still open. Both do
+// nothing while no trace is being written.
+void trace_begin(const char* name);
+void trace_end();
+void finish_trace();
+
+#endif
\ No newline at end of file